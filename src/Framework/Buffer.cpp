@@ -1,13 +1,14 @@
 #include "LumenPCH.h"
 #include "Buffer.h"
 #include "CommandBuffer.h"
+#include "UploadBatch.h"
 #include "VkUtils.h"
 
 void Buffer::create(const char* name, VulkanContext* ctx,
 					VkBufferUsageFlags usage,
 					VkMemoryPropertyFlags mem_property_flags,
 					VkSharingMode sharing_mode, VkDeviceSize size, void* data,
-					bool use_staging) {
+					bool use_staging, AllocationStrategy strategy) {
 	if (!this->ctx) {
 		this->ctx = ctx;
 		this->mem_property_flags = mem_property_flags;
@@ -15,27 +16,14 @@ void Buffer::create(const char* name, VulkanContext* ctx,
 	}
 
 	if (use_staging) {
-		Buffer staging_buffer;
-
 		LUMEN_ASSERT(mem_property_flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 					 "Buffer creation error");
-		staging_buffer.create(ctx, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-							  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
-								  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-							  VK_SHARING_MODE_EXCLUSIVE, size, data);
-
-		staging_buffer.unmap();
-		this->create(ctx, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
-					 mem_property_flags, sharing_mode, size, nullptr);
-
-		CommandBuffer copy_cmd(ctx, true);
-		VkBufferCopy copy_region = {};
-
-		copy_region.size = size;
-		vkCmdCopyBuffer(copy_cmd.handle, staging_buffer.handle, this->handle, 1,
-						&copy_region);
-		copy_cmd.submit(ctx->queues[0]);
-		staging_buffer.destroy();
+		this->create("", ctx, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
+					 mem_property_flags, sharing_mode, size, nullptr, false,
+					 strategy);
+		UploadBatch batch(ctx);
+		batch.upload(*this, data, size);
+		batch.submit();
 	} else {
 		// Create the buffer handle
 		VkBufferCreateInfo buffer_CI =
@@ -43,26 +31,13 @@ void Buffer::create(const char* name, VulkanContext* ctx,
 		vk::check(
 			vkCreateBuffer(ctx->device, &buffer_CI, nullptr, &this->handle),
 			"Failed to create vertex buffer!");
+		gfx_owned = false;
 
-		// Create the memory backing up the buffer handle
+		// Sub-allocate the memory backing up the buffer handle
 		VkMemoryRequirements mem_reqs;
-		VkMemoryAllocateInfo mem_alloc_info = vk::memory_allocate_info();
 		vkGetBufferMemoryRequirements(ctx->device, this->handle, &mem_reqs);
-
-		mem_alloc_info.allocationSize = mem_reqs.size;
-		// Find a memory type index that fits the properties of the buffer
-		mem_alloc_info.memoryTypeIndex = find_memory_type(
-			&ctx->physical_device, mem_reqs.memoryTypeBits, mem_property_flags);
-
-		VkMemoryAllocateFlagsInfo flags_info{
-			VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO};
-		if (usage_flags & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
-			flags_info.flags |= VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
-			mem_alloc_info.pNext = &flags_info;
-		}
-		vk::check(vkAllocateMemory(ctx->device, &mem_alloc_info, nullptr,
-								   &this->buffer_memory),
-				  "Failed to allocate buffer memory!");
+		allocation = ctx->allocator->allocate_buffer(this->handle,
+													 mem_property_flags, strategy);
 
 		alignment = mem_reqs.alignment;
 		this->size = size;
@@ -92,12 +67,22 @@ void Buffer::create(const char* name, VulkanContext* ctx,
 		this->name = name;
 	}
 }
+void Buffer::create(const char* name, VulkanContext* ctx,
+					VkBufferUsageFlags usage,
+					VkMemoryPropertyFlags mem_property_flags,
+					VkSharingMode sharing_mode, VkDeviceSize size,
+					const void* data, UploadBatch& batch) {
+	create(name, ctx, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
+		   mem_property_flags, sharing_mode, size);
+	batch.upload(*this, data, size);
+}
+
 void Buffer::flush(VkDeviceSize size, VkDeviceSize offset) {
 	VkMappedMemoryRange mapped_range = {};
 	mapped_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-	mapped_range.memory = buffer_memory;
-	mapped_range.offset = offset;
-	mapped_range.size = size;
+	mapped_range.memory = allocation.memory;
+	mapped_range.offset = allocation.offset + offset;
+	mapped_range.size = size == VK_WHOLE_SIZE ? allocation.size - offset : size;
 	vk::check(vkFlushMappedMemoryRanges(ctx->device, 1, &mapped_range),
 			  "Failed to flush mapped memory ranges");
 }
@@ -105,9 +90,9 @@ void Buffer::flush(VkDeviceSize size, VkDeviceSize offset) {
 void Buffer::invalidate(VkDeviceSize size, VkDeviceSize offset) {
 	VkMappedMemoryRange mapped_range = {};
 	mapped_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-	mapped_range.memory = buffer_memory;
-	mapped_range.offset = offset;
-	mapped_range.size = size;
+	mapped_range.memory = allocation.memory;
+	mapped_range.offset = allocation.offset + offset;
+	mapped_range.size = size == VK_WHOLE_SIZE ? allocation.size - offset : size;
 	vk::check(vkInvalidateMappedMemoryRanges(ctx->device, 1, &mapped_range),
 			  "Failed to invalidate mapped memory range");
 }
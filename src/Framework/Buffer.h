@@ -1,8 +1,10 @@
 #pragma once
 #include "LumenPCH.h"
+#include "MemoryAllocator.h"
+class UploadBatch;
 struct Buffer {
 	VkBuffer handle{};
-	VkDeviceMemory buffer_memory = VK_NULL_HANDLE;
+	MemoryAllocation allocation;
 	VulkanContext* ctx = nullptr;
 	void* data = nullptr;
 	VkDescriptorBufferInfo descriptor = {};
@@ -11,21 +13,28 @@ struct Buffer {
 	VkBufferUsageFlags usage_flags = 0;
 	VkMemoryPropertyFlags mem_property_flags = 0;
 	std::string name;
+	// Set once an upload on the dedicated transfer queue released the buffer to
+	// the graphics queue. The transfer queue can't write it again without a
+	// release from graphics first
+	bool gfx_owned = false;
 
 	inline void destroy() {
 		if (handle) vkDestroyBuffer(ctx->device, handle, nullptr);
-		if (buffer_memory) vkFreeMemory(ctx->device, buffer_memory, nullptr);
+		if (allocation.memory) ctx->allocator->free(allocation);
 	}
 
 	inline void bind(VkDeviceSize offset = 0) {
-		vk::check(vkBindBufferMemory(ctx->device, handle, buffer_memory, offset), "Failed to bind buffer");
+		vk::check(vkBindBufferMemory(ctx->device, handle, allocation.memory, allocation.offset + offset),
+				  "Failed to bind buffer");
 	}
 
+	// Host visible memory is persistently mapped by the allocator
 	inline void map(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0) {
-		vk::check(vkMapMemory(ctx->device, buffer_memory, offset, size, 0, &data), "Unable to map memory");
+		LUMEN_ASSERT(allocation.mapped, "Buffer memory is not host visible");
+		data = (uint8_t*)allocation.mapped + offset;
 	}
 
-	inline void unmap() { vkUnmapMemory(ctx->device, buffer_memory); }
+	inline void unmap() { data = nullptr; }
 
 	inline VkDeviceAddress get_device_address() {
 		VkBufferDeviceAddressInfo info = {VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
@@ -34,7 +43,12 @@ struct Buffer {
 	}
 
 	void create(const char* name, VulkanContext*, VkBufferUsageFlags, VkMemoryPropertyFlags, VkSharingMode,
-				VkDeviceSize, void* data = nullptr, bool use_staging = false);
+				VkDeviceSize, void* data = nullptr, bool use_staging = false,
+				AllocationStrategy strategy = AllocationStrategy::FreeList);
+
+	// Device local buffer whose contents are uploaded as part of the batch
+	void create(const char* name, VulkanContext*, VkBufferUsageFlags, VkMemoryPropertyFlags, VkSharingMode,
+				VkDeviceSize, const void* data, UploadBatch& batch);
 
 	inline void create(VulkanContext* ctx, VkBufferUsageFlags flags, VkMemoryPropertyFlags mem_property_flags,
 					   VkSharingMode sharing_mode, VkDeviceSize size, void* data = nullptr, bool use_staging = false) {
@@ -25,6 +25,19 @@ class Camera {
 	}
 
 	inline void rotate(const glm::vec3& delta) { this->rotation += delta; }
+
+	// Narrows the projection to a window of the image, in pixels, so that the image
+	// can be rendered in tiles. Windows may extend past the image
+	void set_tile(const glm::uvec2& offset, const glm::uvec2& size, const glm::uvec2& image_size) {
+		const glm::vec2 scale = glm::vec2(image_size) / glm::vec2(size);
+		const glm::vec2 center = (2.0f * glm::vec2(offset) + glm::vec2(size)) / glm::vec2(image_size) - 1.0f;
+		glm::mat4 tile{1.f};
+		tile[0][0] = scale.x;
+		tile[1][1] = scale.y;
+		tile[3][0] = -scale.x * center.x;
+		tile[3][1] = -scale.y * center.y;
+		projection = tile * image_projection;
+	}
 	void update_view_matrix() {
 		constexpr glm::vec3 UP = glm::vec3(0, 1, 0);
 		constexpr glm::vec3 RIGHT = glm::vec3(1, 0, 0);
@@ -45,6 +58,8 @@ class Camera {
 
    protected:
 	virtual void make_projection_matrix(bool use_fov) = 0;
+	// Projection of the whole image
+	glm::mat4 image_projection{1.f};
 
    private:
 };
@@ -122,6 +137,7 @@ class PerspectiveCamera : public Camera {
 			projection[2][3] = -1;
 			projection[3][2] = cam_near * cam_far / (cam_near - cam_far);
 		}
+		image_projection = projection;
 	}
 
 	float fov{}, aspect_ratio{};
@@ -4,24 +4,21 @@ CommandBuffer::CommandBuffer(VulkanContext* ctx, bool begin, VkCommandBufferUsag
 							 VkCommandBufferLevel level) {
 	this->ctx = ctx;
 	this->type = type;
-	std::unique_lock<std::mutex> cv_lock;
-	VulkanSyncronization::cv.wait(cv_lock, [&] {return VulkanSyncronization::available_command_pools > 0; });
-	curr_tid = --VulkanSyncronization::available_command_pools;
-	auto cmd_buf_allocate_info = vk::command_buffer_allocate_info(ctx->cmd_pools[curr_tid], level, 1);
-	vk::check(vkAllocateCommandBuffers(ctx->device, &cmd_buf_allocate_info, &handle),
-			  "Could not allocate command buffer");
+	pooled = ctx->cmd_buffer_pool->acquire(level);
+	handle = pooled.handle;
 	if (begin) {
-		auto begin_info = vk::command_buffer_begin_info(begin_flags);
-		vk::check(vkBeginCommandBuffer(handle, &begin_info), "Could not begin the command buffer");
-		state = CommandBufferState::RECORDING;
+		this->begin(begin_flags);
 	}
 }
 
 void CommandBuffer::begin(VkCommandBufferUsageFlags begin_flags) {
 	LUMEN_ASSERT(state != CommandBufferState::RECORDING, "Command buffer is already recording");
-	std::unique_lock<std::mutex> cv_lock;
-	VulkanSyncronization::cv.wait(cv_lock, [&] {return VulkanSyncronization::available_command_pools > 0; });
-	--VulkanSyncronization::available_command_pools;
+	if (pending_fence) {
+		// Beginning resets the command buffer, which must not be in flight anymore
+		vk::check(vkWaitForFences(ctx->device, 1, &pending_fence, VK_TRUE, 100000000000), "Fence wait error");
+		ctx->cmd_buffer_pool->fences.release(pending_fence);
+		pending_fence = VK_NULL_HANDLE;
+	}
 	auto begin_info = vk::command_buffer_begin_info(begin_flags);
 	vk::check(vkBeginCommandBuffer(handle, &begin_info), "Could not begin the command buffer");
 	state = CommandBufferState::RECORDING;
@@ -29,27 +26,25 @@ void CommandBuffer::begin(VkCommandBufferUsageFlags begin_flags) {
 
 void CommandBuffer::submit(bool wait_fences, bool queue_wait_idle) {
 	vk::check(vkEndCommandBuffer(handle), "Failed to end command buffer");
-	++VulkanSyncronization::available_command_pools;
-	VulkanSyncronization::cv.notify_one();
 	state = CommandBufferState::STOPPED;
 	VkSubmitInfo submit_info = vk::submit_info();
 	submit_info.commandBufferCount = 1;
 	submit_info.pCommandBuffers = &handle;
-	VulkanSyncronization::queue_mutex.lock();
-	if (wait_fences) {
-		VkFenceCreateInfo fence_info = vk::fence_create_info(0);
-		VkFence fence;
-		vk::check(vkCreateFence(ctx->device, &fence_info, nullptr, &fence), "Fence creation error");
+	VkFence fence = ctx->cmd_buffer_pool->fences.acquire();
+	{
+		std::lock_guard<std::mutex> queue_lock(VulkanSyncronization::queue_mutex);
 		vk::check(vkQueueSubmit(ctx->queues[(int)type], 1, &submit_info, fence), "Queue submission error");
+		if (queue_wait_idle) {
+			vk::check(vkQueueWaitIdle(ctx->queues[(int)type]), "Queue wait error! Check previous submissions");
+		}
+	}
+	if (wait_fences) {
+		// Waited outside of the queue lock so that other threads can keep submitting
 		vk::check(vkWaitForFences(ctx->device, 1, &fence, VK_TRUE, 100000000000), "Fence wait error");
-		vkDestroyFence(ctx->device, fence, nullptr);
+		ctx->cmd_buffer_pool->fences.release(fence);
 	} else {
-		vk::check(vkQueueSubmit(ctx->queues[(int)type], 1, &submit_info, VK_NULL_HANDLE), "Queue submission error");
-	}
-	if (queue_wait_idle) {
-		vk::check(vkQueueWaitIdle(ctx->queues[(int)type]), "Queue wait error! Check previous submissions");
+		pending_fence = fence;
 	}
-	VulkanSyncronization::queue_mutex.unlock();
 }
 
 CommandBuffer::~CommandBuffer() {
@@ -58,8 +53,7 @@ CommandBuffer::~CommandBuffer() {
 	}
 	if (state == CommandBufferState::RECORDING) {
 		vk::check(vkEndCommandBuffer(handle), "Failed to end command buffer");
-		++VulkanSyncronization::available_command_pools;
-		VulkanSyncronization::cv.notify_one();
 	}
-	vkFreeCommandBuffers(ctx->device, ctx->cmd_pools[curr_tid], 1, &handle);
+	// Reused once the pending submission, if any, has finished
+	ctx->cmd_buffer_pool->release(pooled, pending_fence);
 }
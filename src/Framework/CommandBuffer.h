@@ -1,5 +1,6 @@
 #pragma once
 #include "LumenPCH.h"
+#include "CommandBufferPool.h"
 
 class CommandBuffer {
    public:
@@ -16,5 +17,7 @@ class CommandBuffer {
 	VulkanContext* ctx;
 	CommandBufferState state = CommandBufferState::STOPPED;
 	QueueType type;
-	uint32_t curr_tid;
+	PooledCommandBuffer pooled;
+	// Fence of the last submission that was not waited on
+	VkFence pending_fence = VK_NULL_HANDLE;
 };
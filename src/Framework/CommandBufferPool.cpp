@@ -0,0 +1,137 @@
+#include "LumenPCH.h"
+#include "CommandBufferPool.h"
+
+void FencePool::destroy() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto fence : free_fences) {
+		vkDestroyFence(device, fence, nullptr);
+	}
+	if (free_fences.size() != num_fences) {
+		LUMEN_WARN("{} fences were not returned to the pool", num_fences - free_fences.size());
+	}
+	free_fences.clear();
+	num_fences = 0;
+}
+
+VkFence FencePool::acquire() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!free_fences.empty()) {
+			VkFence fence = free_fences.back();
+			free_fences.pop_back();
+			return fence;
+		}
+		num_fences++;
+	}
+	VkFenceCreateInfo fence_info = vk::fence_create_info(0);
+	VkFence fence;
+	vk::check(vkCreateFence(device, &fence_info, nullptr, &fence), "Fence creation error");
+	return fence;
+}
+
+void FencePool::release(VkFence fence) {
+	vk::check(vkResetFences(device, 1, &fence), "Fence reset error");
+	std::lock_guard<std::mutex> lock(mutex);
+	free_fences.push_back(fence);
+}
+
+struct ThreadCommandPool {
+	struct FreeBuffer {
+		VkCommandBuffer handle;
+		VkCommandBufferLevel level;
+		VkFence fence;
+	};
+	VkCommandPool pool = VK_NULL_HANDLE;
+	// Releases may come from other threads, the pool itself is only used by its owner
+	std::mutex mutex;
+	std::vector<FreeBuffer> free_buffers;
+};
+
+// Bumped on every init so that thread local pointers into a destroyed pool are never used
+static std::atomic<uint64_t> pool_generation = 0;
+
+struct ThreadPoolSlot {
+	uint64_t generation = 0;
+	ThreadCommandPool* pool = nullptr;
+};
+static thread_local ThreadPoolSlot thread_slot;
+
+CommandBufferPool::~CommandBufferPool() { destroy(); }
+
+void CommandBufferPool::init(VulkanContext* ctx) {
+	this->ctx = ctx;
+	generation = ++pool_generation;
+	fences.init(ctx->device);
+}
+
+void CommandBufferPool::destroy() {
+	if (!ctx) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& thread_pool : thread_pools) {
+		for (auto& buffer : thread_pool->free_buffers) {
+			if (buffer.fence) {
+				fences.release(buffer.fence);
+			}
+		}
+		// Frees every command buffer allocated from it
+		vkDestroyCommandPool(ctx->device, thread_pool->pool, nullptr);
+	}
+	thread_pools.clear();
+	fences.destroy();
+	ctx = nullptr;
+}
+
+ThreadCommandPool* CommandBufferPool::get_thread_pool() {
+	if (thread_slot.generation == generation) {
+		return thread_slot.pool;
+	}
+	VkCommandPoolCreateInfo pool_info = vk::command_pool_CI(VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
+															VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+	pool_info.queueFamilyIndex = ctx->indices.gfx_family.value();
+	auto thread_pool = std::make_unique<ThreadCommandPool>();
+	vk::check(vkCreateCommandPool(ctx->device, &pool_info, nullptr, &thread_pool->pool),
+			  "Failed to create command pool!");
+	thread_slot = {generation, thread_pool.get()};
+	std::lock_guard<std::mutex> lock(mutex);
+	thread_pools.push_back(std::move(thread_pool));
+	return thread_slot.pool;
+}
+
+PooledCommandBuffer CommandBufferPool::acquire(VkCommandBufferLevel level) {
+	ThreadCommandPool* thread_pool = get_thread_pool();
+	PooledCommandBuffer cmd;
+	cmd.level = level;
+	cmd.owner = thread_pool;
+	VkFence fence = VK_NULL_HANDLE;
+	{
+		std::lock_guard<std::mutex> lock(thread_pool->mutex);
+		auto& free_buffers = thread_pool->free_buffers;
+		for (size_t i = 0; i < free_buffers.size(); i++) {
+			const auto& buffer = free_buffers[i];
+			if (buffer.level != level || (buffer.fence && vkGetFenceStatus(ctx->device, buffer.fence) != VK_SUCCESS)) {
+				continue;
+			}
+			cmd.handle = buffer.handle;
+			fence = buffer.fence;
+			free_buffers[i] = free_buffers.back();
+			free_buffers.pop_back();
+			break;
+		}
+	}
+	if (fence) {
+		fences.release(fence);
+	}
+	if (!cmd.handle) {
+		auto cmd_buf_allocate_info = vk::command_buffer_allocate_info(thread_pool->pool, level, 1);
+		vk::check(vkAllocateCommandBuffers(ctx->device, &cmd_buf_allocate_info, &cmd.handle),
+				  "Could not allocate command buffer");
+	}
+	return cmd;
+}
+
+void CommandBufferPool::release(const PooledCommandBuffer& cmd, VkFence fence) {
+	std::lock_guard<std::mutex> lock(cmd.owner->mutex);
+	cmd.owner->free_buffers.push_back({cmd.handle, cmd.level, fence});
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "LumenPCH.h"
+
+// Recycles fences instead of creating one per submission
+class FencePool {
+   public:
+	void init(VkDevice device) { this->device = device; }
+	void destroy();
+	VkFence acquire();
+	// The fence must be signaled or never submitted
+	void release(VkFence fence);
+
+   private:
+	VkDevice device = VK_NULL_HANDLE;
+	std::vector<VkFence> free_fences;
+	std::mutex mutex;
+	uint32_t num_fences = 0;
+};
+
+struct ThreadCommandPool;
+
+struct PooledCommandBuffer {
+	VkCommandBuffer handle = VK_NULL_HANDLE;
+	VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	ThreadCommandPool* owner = nullptr;
+};
+
+// Hands out command buffers from a pool owned by the calling thread, so ThreadPool
+// workers never wait on each other to allocate or record. Released command buffers
+// go back to their pool and are reused, implicitly reset by the next begin, once
+// the fence of their last submission has signaled.
+class CommandBufferPool {
+   public:
+	CommandBufferPool() = default;
+	~CommandBufferPool();
+	void init(VulkanContext* ctx);
+	void destroy();
+	PooledCommandBuffer acquire(VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+	// Can be called from any thread. The fence guards the last submission that was not
+	// waited on and goes back to the fence pool once the command buffer is reused
+	void release(const PooledCommandBuffer& cmd, VkFence fence = VK_NULL_HANDLE);
+
+	FencePool fences;
+
+   private:
+	ThreadCommandPool* get_thread_pool();
+
+	VulkanContext* ctx = nullptr;
+	uint64_t generation = 0;
+	// Only taken when a thread creates its pool
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ThreadCommandPool>> thread_pools;
+};
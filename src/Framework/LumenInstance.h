@@ -9,10 +9,13 @@
 #include <glm/glm.hpp>
 class LumenInstance {
    public:
-	LumenInstance(int width, int height, int debug) : width(width), height(height), debug(debug), vkb(debug){};
+	LumenInstance(int width, int height, int debug)
+		: width(width), height(height), image_width(width), image_height(height), debug(debug), vkb(debug){};
 	VulkanBase vkb;
 	VulkanContext& vk_ctx = vkb.ctx;
 	uint32_t width, height, debug;
+	// Size of the final image, larger than width x height when it is rendered in tiles
+	uint32_t image_width, image_height;
 	virtual void init(Window*) = 0;
 	virtual void update() = 0;
 	virtual void cleanup() = 0;
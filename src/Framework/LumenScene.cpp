@@ -1,9 +1,11 @@
 #include "LumenPCH.h"
 #include "LumenScene.h"
+#include "SceneCache.h"
 #pragma warning(push, 0)
 #include <json.hpp>
 #pragma warning(pop)
 #include <tiny_obj_loader.h>
+#include "GltfScene.hpp"
 #include "shaders/commons.h"
 
 struct Bbox {
@@ -72,7 +74,112 @@ struct Bbox {
 	glm::vec3 m_max{std::numeric_limits<float>::lowest()};
 };
 
+// Indexed geometry of a single OBJ shape, with indices relative to the shape
+struct ObjMeshData {
+	std::string name;
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texcoords;
+	std::vector<uint32_t> indices;
+	glm::vec3 min_pos = glm::vec3(FLT_MAX);
+	glm::vec3 max_pos = glm::vec3(-FLT_MAX);
+};
+
+struct WeldKey {
+	glm::vec3 pos;
+	glm::vec3 nrm;
+	glm::vec2 uv;
+	bool operator==(const WeldKey& other) const { return memcmp(this, &other, sizeof(WeldKey)) == 0; }
+};
+
+struct WeldKeyHash {
+	size_t operator()(const WeldKey& key) const { return robin_hood::hash_bytes(&key, sizeof(WeldKey)); }
+};
+
+// Builds an indexed mesh out of the face corners of a shape. Corners sharing
+// the same position, normal and texcoord are welded into a single vertex.
+// Missing normals/texcoords are zero filled so that the attribute arrays stay
+// parallel to the positions.
+static void weld_obj_shape(const tinyobj::attrib_t& attrib, const tinyobj::shape_t& shape, ObjMeshData& out) {
+	const size_t num_corners = shape.mesh.indices.size();
+	robin_hood::unordered_flat_map<WeldKey, uint32_t, WeldKeyHash> vertex_map;
+	vertex_map.reserve(num_corners);
+	out.indices.reserve(num_corners);
+	for (size_t i = 0; i < num_corners; i++) {
+		const tinyobj::index_t& idx = shape.mesh.indices[i];
+		WeldKey key{glm::vec3(0), glm::vec3(0), glm::vec2(0)};
+		key.pos = {attrib.vertices[3 * uint32_t(idx.vertex_index) + 0],
+				   attrib.vertices[3 * uint32_t(idx.vertex_index) + 1],
+				   attrib.vertices[3 * uint32_t(idx.vertex_index) + 2]};
+		if (idx.normal_index >= 0) {
+			key.nrm = {attrib.normals[3 * uint32_t(idx.normal_index) + 0],
+					   attrib.normals[3 * uint32_t(idx.normal_index) + 1],
+					   attrib.normals[3 * uint32_t(idx.normal_index) + 2]};
+		}
+		if (idx.texcoord_index >= 0) {
+			key.uv = {attrib.texcoords[2 * uint32_t(idx.texcoord_index) + 0],
+					  attrib.texcoords[2 * uint32_t(idx.texcoord_index) + 1]};
+		}
+		auto [it, inserted] = vertex_map.try_emplace(key, (uint32_t)out.positions.size());
+		if (inserted) {
+			out.positions.push_back(key.pos);
+			out.normals.push_back(key.nrm);
+			out.texcoords.push_back(key.uv);
+			out.min_pos = glm::min(key.pos, out.min_pos);
+			out.max_pos = glm::max(key.pos, out.max_pos);
+		}
+		out.indices.push_back(it->second);
+	}
+}
+
+// Parses a single shape OBJ file into a staging buffer. Called from the thread
+// pool, so failures are returned to the caller instead of exiting
+static bool load_obj_mesh(const std::string& mesh_file, ObjMeshData& out) {
+	tinyobj::ObjReaderConfig reader_config;
+	// reader_config.mtl_search_path = "./"; // Path to material files
+
+	tinyobj::ObjReader reader;
+	if (!reader.ParseFromFile(mesh_file, reader_config)) {
+		if (!reader.Error().empty()) {
+			std::cerr << "TinyObjReader: " << reader.Error();
+		}
+		return false;
+	}
+
+	if (!reader.Warning().empty()) {
+		std::cout << "TinyObjReader: " << reader.Warning();
+	}
+
+	auto& shapes = reader.GetShapes();
+	assert(shapes.size() == 1);
+	out.name = shapes[0].name;
+	weld_obj_shape(reader.GetAttrib(), shapes[0], out);
+	return true;
+}
+
 using json = nlohmann::json;
+bool LumenScene::set_integrator(const std::string& type) {
+	static const std::unordered_map<std::string, std::pair<IntegratorType, const char*>> integrators = {
+		{"path", {IntegratorType::Path, "Path"}},
+		{"bdpt", {IntegratorType::BDPT, "BDPT"}},
+		{"sppm", {IntegratorType::SPPM, "SPPM"}},
+		{"vcm", {IntegratorType::VCM, "VCM"}},
+		{"pssmlt", {IntegratorType::PSSMLT, "PSSMLT"}},
+		{"smlt", {IntegratorType::SMLT, "SMLT (SBDPT + PSSMLT)"}},
+		{"vcmmlt", {IntegratorType::VCMMLT, "VCMMLT (VCM + PSSMLT)"}},
+		{"restir", {IntegratorType::ReSTIR, "ReSTIR"}},
+		{"restirgi", {IntegratorType::ReSTIRGI, "ReSTIR GI"}},
+		{"ddgi", {IntegratorType::DDGI, "DDGI"}},
+	};
+	auto it = integrators.find(type);
+	if (it == integrators.end()) {
+		return false;
+	}
+	config.integrator_type = it->second.first;
+	config.integrator_name = it->second.second;
+	return true;
+}
+
 void LumenScene::load_scene(const std::string& path) {
 	auto ends_with = [](const std::string& str, const std::string& end) -> bool {
 		if (end.size() > end.size()) return false;
@@ -83,6 +190,45 @@ void LumenScene::load_scene(const std::string& path) {
 
 	auto root = path.substr(0, found + 1);
 
+	const std::string cache_path = SceneCache::get_path(path);
+	if (SceneCache::load(cache_path, *this)) {
+		LUMEN_TRACE("Loaded scene {} from cache", path);
+		return;
+	}
+	// Files the scene is built from, the cache is validated against them
+	std::vector<std::string> source_files = {path};
+
+	// Face corners before welding, for the load report
+	size_t num_corners = 0;
+	// Assigns the mesh offsets with a prefix sum, then concatenates the staged
+	// geometry into the scene arrays in a single pass
+	auto concat_meshes = [this, &num_corners](const std::vector<ObjMeshData>& meshes, LumenPrimMesh* dst) {
+		uint32_t idx_offset = (uint32_t)indices.size();
+		uint32_t vtx_offset = (uint32_t)positions.size();
+		for (size_t m = 0; m < meshes.size(); m++) {
+			dst[m].first_idx = idx_offset;
+			dst[m].vtx_offset = vtx_offset;
+			dst[m].idx_count = (uint32_t)meshes[m].indices.size();
+			dst[m].vtx_count = (uint32_t)meshes[m].positions.size();
+			dst[m].min_pos = meshes[m].min_pos;
+			dst[m].max_pos = meshes[m].max_pos;
+			idx_offset += dst[m].idx_count;
+			vtx_offset += dst[m].vtx_count;
+		}
+		indices.resize(idx_offset);
+		positions.resize(vtx_offset);
+		normals.resize(vtx_offset);
+		texcoords0.resize(vtx_offset);
+		for (size_t m = 0; m < meshes.size(); m++) {
+			const auto& mesh = meshes[m];
+			std::copy(mesh.indices.begin(), mesh.indices.end(), indices.begin() + dst[m].first_idx);
+			std::copy(mesh.positions.begin(), mesh.positions.end(), positions.begin() + dst[m].vtx_offset);
+			std::copy(mesh.normals.begin(), mesh.normals.end(), normals.begin() + dst[m].vtx_offset);
+			std::copy(mesh.texcoords.begin(), mesh.texcoords.end(), texcoords0.begin() + dst[m].vtx_offset);
+			num_corners += mesh.indices.size();
+		}
+	};
+
 	if (ends_with(path, ".json")) {
 		std::ifstream i(path);
 		json j;
@@ -96,55 +242,28 @@ void LumenScene::load_scene(const std::string& path) {
 			auto sky = integrator["sky_col"];
 			config.sky_col = glm::vec3(sky[0], sky[1], sky[2]);
 		}
-		if (integrator["type"] == "path") {
-			config.integrator_type = IntegratorType::Path;
-			config.integrator_name = "Path";
-		} else if (integrator["type"] == "bdpt") {
-			config.integrator_type = IntegratorType::BDPT;
-			config.integrator_name = "BDPT";
-		} else if (integrator["type"] == "sppm") {
-			config.integrator_type = IntegratorType::SPPM;
+		const std::string integrator_type =
+			integrator["type"].is_string() ? integrator["type"].get<std::string>() : std::string();
+		set_integrator(integrator_type);
+		if (integrator_type == "sppm") {
 			config.base_radius = integrator["base_radius"];
-			config.integrator_name = "SPPM";
-		} else if (integrator["type"] == "vcm") {
-			config.integrator_type = IntegratorType::VCM;
+		} else if (integrator_type == "vcm") {
 			config.enable_vm = integrator["enable_vm"] == 1;
 			config.radius_factor = integrator["radius_factor"];
-			config.integrator_name = "VCM";
-		} else if (integrator["type"] == "pssmlt") {
-			config.integrator_type = IntegratorType::PSSMLT;
-			config.mutations_per_pixel = integrator["mutations_per_pixel"];
-			config.num_mlt_threads = integrator["num_mlt_threads"];
-			config.num_bootstrap_samples = integrator["num_bootstrap_samples"];
-			config.integrator_name = "PSSMLT";
-		} else if (integrator["type"] == "smlt") {
-			config.integrator_type = IntegratorType::SMLT;
-			config.mutations_per_pixel = integrator["mutations_per_pixel"];
-			config.num_mlt_threads = integrator["num_mlt_threads"];
-			config.num_bootstrap_samples = integrator["num_bootstrap_samples"];
-			config.integrator_name = "SMLT (SBDPT + PSSMLT)";
-		} else if (integrator["type"] == "vcmmlt") {
-			config.integrator_type = IntegratorType::VCMMLT;
+		} else if (integrator_type == "pssmlt" || integrator_type == "smlt" || integrator_type == "vcmmlt") {
 			config.mutations_per_pixel = integrator["mutations_per_pixel"];
 			config.num_mlt_threads = integrator["num_mlt_threads"];
 			config.num_bootstrap_samples = integrator["num_bootstrap_samples"];
-			config.radius_factor = integrator["radius_factor"];
-			config.enable_vm = integrator["enable_vm"] == 1;
-			config.alternate = integrator["alternate"] == 1;
-			config.light_first = integrator["light_first"] == 1;
-			config.integrator_name = "VCMMLT (VCM + PSSMLT)";
-		} else if (integrator["type"] == "restir") {
-			config.integrator_type = IntegratorType::ReSTIR;
-			config.integrator_name = "ReSTIR";
-		} else if (integrator["type"] == "restirgi") {
-			config.integrator_type = IntegratorType::ReSTIRGI;
-			config.integrator_name = "ReSTIR GI";
-		} else if (integrator["type"] == "ddgi") {
-			config.integrator_type = IntegratorType::DDGI;
-			config.integrator_name = "DDGI";
-		} 
+			if (integrator_type == "vcmmlt") {
+				config.radius_factor = integrator["radius_factor"];
+				config.enable_vm = integrator["enable_vm"] == 1;
+				config.alternate = integrator["alternate"] == 1;
+				config.light_first = integrator["light_first"] == 1;
+			}
+		}
 		// Load obj file
 		const std::string mesh_file = root + std::string(j["mesh_file"]);
+		source_files.push_back(mesh_file);
 		tinyobj::ObjReaderConfig reader_config;
 		// reader_config.mtl_search_path = "./"; // Path to material files
 
@@ -164,46 +283,68 @@ void LumenScene::load_scene(const std::string& path) {
 		auto& shapes = reader.GetShapes();
 
 		prim_meshes.resize(shapes.size());
+		std::vector<ObjMeshData> obj_meshes(shapes.size());
 		for (uint32_t s = 0; s < shapes.size(); s++) {
-			prim_meshes[s].first_idx = (uint32_t)indices.size();
-			prim_meshes[s].vtx_offset = (uint32_t)positions.size();
+			weld_obj_shape(attrib, shapes[s], obj_meshes[s]);
 			prim_meshes[s].name = shapes[s].name;
-			prim_meshes[s].idx_count = (uint32_t)shapes[s].mesh.indices.size();
-			prim_meshes[s].vtx_count = (uint32_t)shapes[s].mesh.num_face_vertices.size();
 			prim_meshes[s].prim_idx = s;
-			glm::vec3 min_vtx = glm::vec3(FLT_MAX);
-			glm::vec3 max_vtx = glm::vec3(-FLT_MAX);
-			uint32_t index_offset = 0;
-			uint32_t idx_val = 0;
-			for (uint32_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-				for (uint32_t v = 0; v < 3; v++) {
-					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-					indices.push_back(idx_val++);
-					tinyobj::real_t vx = attrib.vertices[3 * uint32_t(idx.vertex_index) + 0];
-					tinyobj::real_t vy = attrib.vertices[3 * uint32_t(idx.vertex_index) + 1];
-					tinyobj::real_t vz = attrib.vertices[3 * uint32_t(idx.vertex_index) + 2];
-					positions.emplace_back(vx, vy, vz);
-					min_vtx = glm::min(positions[positions.size() - 1], min_vtx);
-					max_vtx = glm::max(positions[positions.size() - 1], max_vtx);
-					if (idx.normal_index >= 0) {
-						tinyobj::real_t nx = attrib.normals[3 * uint32_t(idx.normal_index) + 0];
-						tinyobj::real_t ny = attrib.normals[3 * uint32_t(idx.normal_index) + 1];
-						tinyobj::real_t nz = attrib.normals[3 * uint32_t(idx.normal_index) + 2];
-						normals.emplace_back(nx, ny, nz);
-					}
-					if (idx.texcoord_index >= 0) {
-						tinyobj::real_t tx = attrib.texcoords[2 * uint32_t(idx.texcoord_index) + 0];
-						tinyobj::real_t ty = attrib.texcoords[2 * uint32_t(idx.texcoord_index) + 1];
-						texcoords0.emplace_back(tx, ty);
+		}
+		concat_meshes(obj_meshes, prim_meshes.data());
+
+		// Instances place a shape with a transform, all of them share the shape's
+		// geometry and BLAS. Shapes not referenced by any instance stay in place
+		auto get_instance_transform = [](json& inst) -> glm::mat4 {
+			if (!inst["matrix"].is_null()) {
+				// Row major, as written in the file
+				const auto& m = inst["matrix"];
+				glm::mat4 mat;
+				for (int r = 0; r < 4; r++) {
+					for (int c = 0; c < 4; c++) {
+						mat[c][r] = m[4 * r + c];
 					}
 				}
-				index_offset += 3;
+				return mat;
+			}
+			glm::mat4 mat(1);
+			if (!inst["translation"].is_null()) {
+				const auto& t = inst["translation"];
+				mat = glm::translate(mat, glm::vec3(t[0], t[1], t[2]));
+			}
+			if (!inst["rotation"].is_null()) {
+				// Euler angles in degrees
+				const auto& r = inst["rotation"];
+				mat = mat * glm::eulerAngleXYZ(glm::radians((float)r[0]), glm::radians((float)r[1]),
+											   glm::radians((float)r[2]));
+			}
+			if (!inst["scale"].is_null()) {
+				const auto& sc = inst["scale"];
+				mat = glm::scale(mat, sc.is_number() ? glm::vec3((float)sc) : glm::vec3(sc[0], sc[1], sc[2]));
+			}
+			return mat;
+		};
+		std::vector<bool> instanced(shapes.size(), false);
+		std::vector<LumenMeshInstance> json_instances;
+		for (auto& inst : j["instances"]) {
+			const std::string mesh_name = inst["mesh"];
+			bool found = false;
+			for (uint32_t s = 0; s < shapes.size(); s++) {
+				if (shapes[s].name == mesh_name) {
+					json_instances.push_back({get_instance_transform(inst), s});
+					instanced[s] = true;
+					found = true;
+					break;
+				}
+			}
+			if (!found) {
+				LUMEN_WARN("Instance references unknown mesh {}", mesh_name);
+			}
+		}
+		for (uint32_t s = 0; s < shapes.size(); s++) {
+			if (!instanced[s]) {
+				mesh_instances.push_back({glm::mat4(1), s});
 			}
-			prim_meshes[s].min_pos = min_vtx;
-			prim_meshes[s].max_pos = max_vtx;
-			prim_meshes[s].world_matrix = glm::mat4(1);
-			// TODO: Implement world transforms
 		}
+		mesh_instances.insert(mesh_instances.end(), json_instances.begin(), json_instances.end());
 		auto& bsdfs_arr = j["bsdfs"];
 		auto& lights_arr = j["lights"];
 		materials.resize(bsdfs_arr.size());
@@ -223,7 +364,7 @@ void LumenScene::load_scene(const std::string& path) {
 			auto& refs = bsdf["refs"];
 
 			if (!bsdf["texture"].is_null()) {
-				textures.push_back(root + (std::string)bsdf["texture"]);
+				textures.push_back({root + (std::string)bsdf["texture"]});
 				materials[bsdf_idx].texture_id = (int)textures.size() - 1;
 			}
 			if (!bsdf["albedo"].is_null()) {
@@ -257,7 +398,6 @@ void LumenScene::load_scene(const std::string& path) {
 				materials[bsdf_idx].metalness = glm::vec3({metalness[0], metalness[1], metalness[2]});
 				materials[bsdf_idx].roughness = bsdf["roughness"];
 			} else if (bsdf["type"] == "disney") {
-#if ENABLE_DISNEY
 				Material& mat = materials[bsdf_idx];
 				mat.bsdf_type = BSDF_DISNEY;
 				mat.albedo = get_or_default_v(bsdf, "albedo", glm::vec3(1));
@@ -271,7 +411,6 @@ void LumenScene::load_scene(const std::string& path) {
 				mat.specular = get_or_default_f(bsdf, "specular", 0.5);
 				mat.sheen = get_or_default_f(bsdf, "sheen", 0);
 				mat.bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN | BSDF_REFLECTIVE;
-#endif
 			}
 
 			for (auto& ref : refs) {
@@ -316,102 +455,47 @@ void LumenScene::load_scene(const std::string& path) {
 		config.path_length = mitsuba_parser.integrator.depth;
 		config.sky_col = mitsuba_parser.integrator.sky_col;
 		// Integrator
-		if (mitsuba_parser.integrator.type == "path") {
-			config.integrator_type = IntegratorType::Path;
-		} else if (mitsuba_parser.integrator.type == "bdpt") {
-			config.integrator_type = IntegratorType::BDPT;
-		} else if (mitsuba_parser.integrator.type == "sppm") {
-			config.integrator_type = IntegratorType::SPPM;
-		} else if (mitsuba_parser.integrator.type == "vcm") {
-			config.integrator_type = IntegratorType::VCM;
+		set_integrator(mitsuba_parser.integrator.type);
+		if (mitsuba_parser.integrator.type == "vcm") {
 			config.enable_vm = mitsuba_parser.integrator.enable_vm;
-		} else if (mitsuba_parser.integrator.type == "pssmlt") {
-			config.integrator_type = IntegratorType::PSSMLT;
-		} else if (mitsuba_parser.integrator.type == "smlt") {
-			config.integrator_type = IntegratorType::SMLT;
-		} else if (mitsuba_parser.integrator.type == "vcmmlt") {
-			config.integrator_type = IntegratorType::VCMMLT;
-		} else if (mitsuba_parser.integrator.type == "restir") {
-			config.integrator_type = IntegratorType::ReSTIR;
-		} else if (mitsuba_parser.integrator.type == "restirgi") {
-			config.integrator_type = IntegratorType::ReSTIRGI;
-		} else if (mitsuba_parser.integrator.type == "ddgi") {
-			config.integrator_type = IntegratorType::DDGI;
 		}
 
 		// Camera
 		config.cam_settings.fov = mitsuba_parser.camera.fov / 2;
 		config.cam_settings.cam_matrix = mitsuba_parser.camera.cam_matrix;
-		prim_meshes.resize(mitsuba_parser.meshes.size());
-		// Load objs
-		int i = 0;
+		// Load objs. Every mesh is parsed and welded into its own staging buffer
+		// on the thread pool, the results are concatenated in the original order
+		std::vector<const MitsubaParser::MitsubaMesh*> file_meshes;
 		for (const auto& mesh : mitsuba_parser.meshes) {
-			if (mesh.file == "") {
-				continue;
+			if (mesh.file != "") {
+				file_meshes.push_back(&mesh);
+				source_files.push_back(root + mesh.file);
 			}
-			const std::string mesh_file = root + mesh.file;
-			tinyobj::ObjReaderConfig reader_config;
-			// reader_config.mtl_search_path = "./"; // Path to material files
-
-			tinyobj::ObjReader reader;
-			if (!reader.ParseFromFile(mesh_file, reader_config)) {
-				if (!reader.Error().empty()) {
-					std::cerr << "TinyObjReader: " << reader.Error();
-				}
-				exit(1);
-			}
-
-			if (!reader.Warning().empty()) {
-				std::cout << "TinyObjReader: " << reader.Warning();
-			}
-
-			auto& attrib = reader.GetAttrib();
-			auto& shapes = reader.GetShapes();
-			assert(shapes.size() == 1);
-			prim_meshes[i].first_idx = (uint32_t)indices.size();
-			prim_meshes[i].vtx_offset = (uint32_t)positions.size();
-			prim_meshes[i].name = shapes[0].name;
-			prim_meshes[i].idx_count = (uint32_t)shapes[0].mesh.indices.size();
-			prim_meshes[i].vtx_count = (uint32_t)shapes[0].mesh.num_face_vertices.size();
-			prim_meshes[i].prim_idx = i;
-			glm::vec3 min_vtx = glm::vec3(FLT_MAX);
-			glm::vec3 max_vtx = glm::vec3(-FLT_MAX);
-			uint32_t index_offset = 0;
-			uint32_t idx_val = 0;
-			for (uint32_t f = 0; f < shapes[0].mesh.num_face_vertices.size(); f++) {
-				for (uint32_t v = 0; v < 3; v++) {
-					tinyobj::index_t idx = shapes[0].mesh.indices[index_offset + v];
-					indices.push_back(idx_val++);
-					tinyobj::real_t vx = attrib.vertices[3 * uint32_t(idx.vertex_index) + 0];
-					tinyobj::real_t vy = attrib.vertices[3 * uint32_t(idx.vertex_index) + 1];
-					tinyobj::real_t vz = attrib.vertices[3 * uint32_t(idx.vertex_index) + 2];
-					positions.emplace_back(vx, vy, vz);
-					min_vtx = glm::min(positions[positions.size() - 1], min_vtx);
-					max_vtx = glm::max(positions[positions.size() - 1], max_vtx);
-					if (idx.normal_index >= 0) {
-						tinyobj::real_t nx = attrib.normals[3 * uint32_t(idx.normal_index) + 0];
-						tinyobj::real_t ny = attrib.normals[3 * uint32_t(idx.normal_index) + 1];
-						tinyobj::real_t nz = attrib.normals[3 * uint32_t(idx.normal_index) + 2];
-						normals.emplace_back(nx, ny, nz);
-					}
-					if (idx.texcoord_index >= 0) {
-						tinyobj::real_t tx = attrib.texcoords[2 * uint32_t(idx.texcoord_index) + 0];
-						tinyobj::real_t ty = attrib.texcoords[2 * uint32_t(idx.texcoord_index) + 1];
-						texcoords0.emplace_back(tx, ty);
-					}
-				}
-
-				index_offset += 3;
-			}
-			prim_meshes[i].min_pos = min_vtx;
-			prim_meshes[i].max_pos = max_vtx;
-			prim_meshes[i].world_matrix = mesh.transform;
-			prim_meshes[i].material_idx = mesh.bsdf_idx;
-			i++;
 		}
+		std::vector<ObjMeshData> obj_meshes(file_meshes.size());
+		std::vector<std::future<bool>> futures;
+		futures.reserve(file_meshes.size());
+		for (size_t m = 0; m < file_meshes.size(); m++) {
+			futures.push_back(ThreadPool::submit(
+				[&obj_meshes, &file_meshes, &root, m]() { return load_obj_mesh(root + file_meshes[m]->file, obj_meshes[m]); }));
+		}
+		bool loaded = true;
+		for (auto& future : futures) {
+			loaded &= future.get();
+		}
+		if (!loaded) {
+			exit(1);
+		}
+		prim_meshes.resize(file_meshes.size());
+		for (uint32_t m = 0; m < file_meshes.size(); m++) {
+			prim_meshes[m].name = obj_meshes[m].name;
+			prim_meshes[m].prim_idx = m;
+			prim_meshes[m].material_idx = file_meshes[m]->bsdf_idx;
+			mesh_instances.push_back({file_meshes[m]->transform, m});
+		}
+		concat_meshes(obj_meshes, prim_meshes.data());
 
 		auto make_default_disney = [](Material& m) {
-#if ENABLE_DISNEY
 			m.bsdf_type = BSDF_DISNEY;
 			m.bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN | BSDF_REFLECTIVE;
 			m.albedo = vec3(1.0);
@@ -424,65 +508,63 @@ void LumenScene::load_scene(const std::string& path) {
 			m.subsurface = 0;
 			m.specular = 0.5;
 			m.sheen = 0;
-#endif
 		};
-		i = 0;
+		int i = 0;
 		materials.resize(mitsuba_parser.bsdfs.size());
 		for (const auto& m_bsdf : mitsuba_parser.bsdfs) {
 			if (m_bsdf.texture != "") {
-				textures.push_back(root + m_bsdf.texture);
+				textures.push_back({root + m_bsdf.texture});
 				materials[i].texture_id = (int)textures.size() - 1;
 			} else {
 				materials[i].texture_id = -1;
 			}
-#if ENABLE_DISNEY
-			make_default_disney(materials[i]);
-			// Assume Disney for other materials for now
-			if (m_bsdf.type == "diffuse") {
-				materials[i].albedo = m_bsdf.albedo;
-			} else if (m_bsdf.type == "roughconductor") {
-				materials[i].metallic = 1;
-				materials[i].roughness = m_bsdf.roughness;
+			if constexpr (MATERIAL_MAPPING == MaterialMapping::Disney) {
+				make_default_disney(materials[i]);
+				// Assume Disney for other materials for now
+				if (m_bsdf.type == "diffuse") {
+					materials[i].albedo = m_bsdf.albedo;
+				} else if (m_bsdf.type == "roughconductor") {
+					materials[i].metallic = 1;
+					materials[i].roughness = m_bsdf.roughness;
+					materials[i].albedo = m_bsdf.albedo;
+
+				} else if (m_bsdf.type == "roughplastic") {
+					materials[i].subsurface = 0.1f;
+					materials[i].albedo = m_bsdf.albedo;
+					materials[i].roughness = m_bsdf.roughness;
+				} else if (m_bsdf.type == "conductor") {
+					materials[i].bsdf_type = BSDF_MIRROR;
+					materials[i].bsdf_props = BSDF_SPECULAR | BSDF_REFLECTIVE;
+				}
+			} else if constexpr (MATERIAL_MAPPING == MaterialMapping::DiffuseOnly) {
 				materials[i].albedo = m_bsdf.albedo;
-
-			} else if (m_bsdf.type == "roughplastic") {
-				materials[i].subsurface = 0.1f;
+				materials[i].bsdf_type = BSDF_DIFFUSE;
+				materials[i].bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN;
+			} else {
 				materials[i].albedo = m_bsdf.albedo;
-				materials[i].roughness = m_bsdf.roughness;
-			} else if (m_bsdf.type == "conductor") {
-				materials[i].bsdf_type = BSDF_MIRROR;
-				materials[i].bsdf_props = BSDF_SPECULAR | BSDF_REFLECTIVE;
-			}
-#elif DIFFUSE_ONLY
-			materials[i].albedo = m_bsdf.albedo;
-			materials[i].bsdf_type = BSDF_DIFFUSE;
-			materials[i].bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN;
-
-#elif DIFFUSE_AND_GLOSSY_ONLY
-			materials[i].albedo = m_bsdf.albedo;
-			materials[i].bsdf_type = BSDF_DIFFUSE;
-			materials[i].bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN;
-			if (m_bsdf.type == "conductor") {
-				materials[i].bsdf_type = BSDF_MIRROR;
-				materials[i].bsdf_props = BSDF_SPECULAR | BSDF_REFLECTIVE;
-			} else if (m_bsdf.type == "glass") {
-				materials[i].bsdf_type = BSDF_GLASS;
-				materials[i].bsdf_props = BSDF_SPECULAR | BSDF_TRANSMISSIVE;
-				materials[i].ior = m_bsdf.ior;
-			} else if (m_bsdf.type == "roughconductor") {
-				materials[i].bsdf_type = BSDF_GLOSSY;
-				materials[i].bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN | BSDF_REFLECTIVE;
-				materials[i].metalness = m_bsdf.albedo;
-				materials[i].albedo = vec3(1);
-				materials[i].roughness = m_bsdf.roughness * m_bsdf.roughness;
-			} else if (m_bsdf.type == "roughplastic") {
-				materials[i].bsdf_type = BSDF_GLOSSY;
-				materials[i].bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN | BSDF_REFLECTIVE;
-				materials[i].albedo = glm::pi<float>() * m_bsdf.albedo;
-				materials[i].metalness = vec3(0.1f);
-				materials[i].roughness = m_bsdf.roughness * m_bsdf.roughness;
+				materials[i].bsdf_type = BSDF_DIFFUSE;
+				materials[i].bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN;
+				if (m_bsdf.type == "conductor") {
+					materials[i].bsdf_type = BSDF_MIRROR;
+					materials[i].bsdf_props = BSDF_SPECULAR | BSDF_REFLECTIVE;
+				} else if (m_bsdf.type == "glass") {
+					materials[i].bsdf_type = BSDF_GLASS;
+					materials[i].bsdf_props = BSDF_SPECULAR | BSDF_TRANSMISSIVE;
+					materials[i].ior = m_bsdf.ior;
+				} else if (m_bsdf.type == "roughconductor") {
+					materials[i].bsdf_type = BSDF_GLOSSY;
+					materials[i].bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN | BSDF_REFLECTIVE;
+					materials[i].metalness = m_bsdf.albedo;
+					materials[i].albedo = vec3(1);
+					materials[i].roughness = m_bsdf.roughness * m_bsdf.roughness;
+				} else if (m_bsdf.type == "roughplastic") {
+					materials[i].bsdf_type = BSDF_GLOSSY;
+					materials[i].bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN | BSDF_REFLECTIVE;
+					materials[i].albedo = glm::pi<float>() * m_bsdf.albedo;
+					materials[i].metalness = vec3(0.1f);
+					materials[i].roughness = m_bsdf.roughness * m_bsdf.roughness;
+				}
 			}
-#endif
 			i++;
 		}
 		compute_scene_dimensions();
@@ -500,14 +582,215 @@ void LumenScene::load_scene(const std::string& path) {
 			}
 			i++;
 		}
+	} else if (ends_with(path, ".gltf") || ends_with(path, ".glb")) {
+		tinygltf::Model tmodel;
+		tinygltf::TinyGLTF tcontext;
+		// Images with a file URI are decoded from it along with the other scene
+		// textures. Embedded images (data URIs and buffer views) keep their
+		// encoded bytes, they are decoded from memory later
+		tcontext.SetImageLoader(
+			[](tinygltf::Image* image, const int, std::string*, std::string*, int, int, const unsigned char* bytes,
+			   int size, void*) {
+				if (image->uri.empty() || tinygltf::IsDataURI(image->uri)) {
+					image->image.assign(bytes, bytes + size);
+					image->as_is = true;
+				}
+				return true;
+			},
+			nullptr);
+		std::string error, warning;
+		bool loaded = ends_with(path, ".glb") ? tcontext.LoadBinaryFromFile(&tmodel, &error, &warning, path)
+											  : tcontext.LoadASCIIFromFile(&tmodel, &error, &warning, path);
+		if (!warning.empty()) {
+			std::cout << "TinyGLTF: " << warning;
+		}
+		if (!loaded) {
+			std::cerr << "TinyGLTF: " << error;
+			exit(1);
+		}
+		for (const auto& buffer : tmodel.buffers) {
+			if (!buffer.uri.empty() && buffer.uri.rfind("data:", 0) != 0) {
+				source_files.push_back(root + buffer.uri);
+			}
+		}
+
+		GltfScene gltf_scene;
+		gltf_scene.import_materials(tmodel);
+		gltf_scene.import_drawable_nodes(tmodel, GltfAttributes::Normal | GltfAttributes::Texcoord_0);
+
+		config.integrator_type = IntegratorType::Path;
+		config.integrator_name = "Path";
+
+		positions = std::move(gltf_scene.positions);
+		indices = std::move(gltf_scene.indices);
+		normals = std::move(gltf_scene.normals);
+		texcoords0 = std::move(gltf_scene.texcoords0);
+
+		// Every primitive is stored once, nodes referencing it become instances
+		prim_meshes.resize(gltf_scene.prim_meshes.size());
+		for (uint32_t p = 0; p < gltf_scene.prim_meshes.size(); p++) {
+			const auto& gpm = gltf_scene.prim_meshes[p];
+			prim_meshes[p].name = gpm.name;
+			prim_meshes[p].material_idx = gpm.material_idx;
+			prim_meshes[p].vtx_offset = gpm.vtx_offset;
+			prim_meshes[p].first_idx = gpm.first_idx;
+			prim_meshes[p].idx_count = gpm.idx_count;
+			prim_meshes[p].vtx_count = gpm.vtx_count;
+			prim_meshes[p].prim_idx = p;
+			prim_meshes[p].min_pos = gpm.pos_min;
+			prim_meshes[p].max_pos = gpm.pos_max;
+		}
+		mesh_instances.reserve(gltf_scene.nodes.size());
+		for (const auto& node : gltf_scene.nodes) {
+			mesh_instances.push_back({node.world_matrix, (uint32_t)node.prim_mesh});
+		}
+
+		// glTF texture index -> scene texture index
+		std::unordered_map<int, int> texture_lookup;
+		auto get_texture = [&](int gltf_tex) -> int {
+			if (gltf_tex < 0 || tmodel.textures[gltf_tex].source < 0) {
+				return -1;
+			}
+			auto it = texture_lookup.find(gltf_tex);
+			if (it != texture_lookup.end()) {
+				return it->second;
+			}
+			const auto& image = tmodel.images[tmodel.textures[gltf_tex].source];
+			int tex_idx = -1;
+			LumenTexture texture;
+			if (!image.image.empty()) {
+				texture.data = image.image;
+			} else if (tinygltf::IsDataURI(image.uri)) {
+				std::string mime_type;
+				tinygltf::DecodeDataURI(&texture.data, mime_type, image.uri, 0, false);
+			} else if (!image.uri.empty()) {
+				texture.path = root + image.uri;
+			}
+			if (texture.path.empty() && texture.data.empty()) {
+				LUMEN_WARN("glTF: Could not read image {}", image.name);
+			} else {
+				textures.push_back(std::move(texture));
+				tex_idx = (int)textures.size() - 1;
+			}
+			texture_lookup[gltf_tex] = tex_idx;
+			return tex_idx;
+		};
+
+		materials.resize(gltf_scene.materials.size());
+		for (size_t m = 0; m < gltf_scene.materials.size(); m++) {
+			const auto& gmat = gltf_scene.materials[m];
+			Material& mat = materials[m];
+			mat.albedo = glm::vec3(gmat.base_color_factor);
+			mat.emissive_factor = gmat.emissive_factor;
+			mat.texture_id = get_texture(gmat.base_color_texture);
+			mat.ior = gmat.ior.ior;
+			if constexpr (MATERIAL_MAPPING == MaterialMapping::Disney) {
+				mat.bsdf_type = BSDF_DISNEY;
+				mat.bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN | BSDF_REFLECTIVE;
+				mat.metallic = gmat.metallic_factor;
+				mat.roughness = gmat.roughness_factor;
+				mat.specular_tint = 0;
+				mat.sheen_tint = 0.5;
+				mat.clearcoat = gmat.clearcoat.factor;
+				mat.clearcoat_gloss = 1 - gmat.clearcoat.roughnessFactor;
+				mat.subsurface = 0;
+				mat.specular = 0.5;
+				mat.sheen = 0;
+			} else if constexpr (MATERIAL_MAPPING == MaterialMapping::DiffuseOnly) {
+				mat.bsdf_type = BSDF_DIFFUSE;
+				mat.bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN;
+			} else {
+				if (gmat.transmission.factor > 0) {
+					mat.bsdf_type = BSDF_GLASS;
+					mat.bsdf_props = BSDF_SPECULAR | BSDF_TRANSMISSIVE;
+				} else if (gmat.metallic_factor > 0) {
+					mat.bsdf_type = BSDF_GLOSSY;
+					mat.bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN | BSDF_REFLECTIVE;
+					mat.metalness = gmat.metallic_factor * mat.albedo;
+					mat.roughness = gmat.roughness_factor * gmat.roughness_factor;
+				} else {
+					mat.bsdf_type = BSDF_DIFFUSE;
+					mat.bsdf_props = BSDF_OPAQUE | BSDF_LAMBERTIAN;
+				}
+			}
+		}
+
+		compute_scene_dimensions();
+		// Camera
+		if (!gltf_scene.cameras.empty()) {
+			const auto& cam = gltf_scene.cameras[0];
+			config.cam_settings.fov = glm::degrees((float)cam.cam.perspective.yfov);
+			config.cam_settings.pos = cam.eye;
+			config.cam_settings.dir = glm::normalize(cam.center - cam.eye);
+			config.cam_settings.cam_matrix = cam.world_matrix;
+		} else {
+			config.cam_settings.fov = 45.0f;
+			config.cam_settings.pos = m_dimensions.center + glm::vec3(0, 0, 2 * m_dimensions.radius);
+			config.cam_settings.dir = glm::vec3(0, 0, -1);
+		}
+		// Lights
+		for (const auto& glight : gltf_scene.lights) {
+			const auto& tlight = glight.light;
+			LumenLight light{};
+			light.pos = glm::vec3(glight.world_matrix[3]);
+			light.to = light.pos - glm::normalize(glm::vec3(glight.world_matrix[2]));
+			light.L = float(tlight.intensity) * (tlight.color.size() == 3 ? glm::vec3(tlight.color[0], tlight.color[1],
+																					  tlight.color[2])
+																		  : glm::vec3(1));
+			if (tlight.type == "spot") {
+				light.light_flags = LIGHT_SPOT;
+				// Is finite
+				light.light_flags |= 1 << 4;
+				// Is delta
+				light.light_flags |= 1 << 5;
+			} else if (tlight.type == "directional") {
+				light.light_flags = LIGHT_DIRECTIONAL;
+				// Is delta
+				light.light_flags |= 1 << 5;
+			} else {
+				LUMEN_WARN("glTF: Unsupported light type {}", tlight.type);
+				continue;
+			}
+			lights.push_back(light);
+		}
+		LUMEN_TRACE("glTF: {} prim meshes, {} instances", prim_meshes.size(), mesh_instances.size());
+	}
+	if (num_corners) {
+		LUMEN_TRACE("Welded {} face corners into {} vertices ({:.1f}% fewer)", num_corners, positions.size(),
+					100.0f * (1.0f - float(positions.size()) / num_corners));
 	}
+	if (!prim_meshes.empty()) {
+		// Textures are decoded from their files on every load, but an edited
+		// texture must still invalidate the cached scene that references it
+		for (const auto& texture : textures) {
+			if (!texture.path.empty()) {
+				source_files.push_back(texture.path);
+			}
+		}
+		std::sort(source_files.begin(), source_files.end());
+		source_files.erase(std::unique(source_files.begin(), source_files.end()), source_files.end());
+		SceneCache::save(cache_path, source_files, *this);
+	}
+}
+
+std::map<std::string, std::string> LumenScene::get_bsdf_defines() const {
+	uint32_t bsdf_mask = 0;
+	for (const auto& material : materials) {
+		bsdf_mask |= material.bsdf_type;
+	}
+	auto enabled = [bsdf_mask](uint32_t bsdf_type) { return (bsdf_mask & bsdf_type) ? "1" : "0"; };
+	return {
+		{"ENABLE_DIFFUSE", enabled(BSDF_DIFFUSE)}, {"ENABLE_MIRROR", enabled(BSDF_MIRROR)},
+		{"ENABLE_GLASS", enabled(BSDF_GLASS)},	   {"ENABLE_GLOSSY", enabled(BSDF_GLOSSY)},
+		{"ENABLE_DISNEY", enabled(BSDF_DISNEY)},
+	};
 }
 
 void LumenScene::compute_scene_dimensions() {
 	Bbox scene_bbox;
-	for (const auto& pm : prim_meshes) {
-		Bbox bbox(pm.min_pos, pm.max_pos);
-		bbox.transform(pm.world_matrix);
+	for (const auto& mi : mesh_instances) {
+		const auto& pm = prim_meshes[mi.prim_mesh_idx];
+		Bbox bbox = Bbox(pm.min_pos, pm.max_pos).transform(mi.world_matrix);
 		scene_bbox.insert(bbox);
 	}
 	if (scene_bbox.is_empty() || !scene_bbox.isVolume()) {
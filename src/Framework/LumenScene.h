@@ -1,6 +1,7 @@
 #pragma once
 #include "LumenPCH.h"
 #include <tiny_obj_loader.h>
+#include <map>
 #include "shaders/commons.h"
 #include "Framework/MitsubaParser.h"
 
@@ -11,6 +12,11 @@ struct CameraSettings {
 	glm::mat4 cam_matrix = glm::mat4();
 };
 
+// How Mitsuba and glTF materials are mapped onto Lumen's BSDFs. Shaders are
+// compiled only with the BSDFs the resulting materials use
+enum class MaterialMapping { Disney, DiffuseOnly, DiffuseAndGlossy };
+static constexpr MaterialMapping MATERIAL_MAPPING = MaterialMapping::DiffuseAndGlossy;
+
 enum class IntegratorType { Path, BDPT, SPPM, VCM, PSSMLT, SMLT, VCMMLT, ReSTIR, ReSTIRGI, DDGI };
 
 struct SceneConfig {
@@ -37,11 +43,23 @@ struct LumenPrimMesh {
 	uint32_t idx_count;
 	uint32_t vtx_count;
 	uint32_t prim_idx;
-	glm::mat4 world_matrix;
 	glm::vec3 min_pos;
 	glm::vec3 max_pos;
 };
 
+// Placement of a prim mesh in the world. Instances of the same prim mesh share
+// its geometry and BLAS
+struct LumenMeshInstance {
+	glm::mat4 world_matrix;
+	uint32_t prim_mesh_idx;
+};
+
+// Either a texture file or the encoded bytes of an image embedded in the scene
+struct LumenTexture {
+	std::string path;
+	std::vector<uint8_t> data;
+};
+
 struct LumenLight {
 	glm::vec3 pos;
 	glm::vec3 to;
@@ -52,6 +70,10 @@ struct LumenLight {
 class LumenScene {
    public:
 	void load_scene(const std::string& path);
+	// Selects an integrator by its name in scene files, e.g. "vcm". Returns false for unknown names
+	bool set_integrator(const std::string& type);
+	// ENABLE_<BSDF> shader defines for the BSDFs used by the materials
+	std::map<std::string, std::string> get_bsdf_defines() const;
 	std::vector<glm::vec3> positions;
 	std::vector<uint32_t> indices;
 	std::vector<glm::vec3> normals;
@@ -60,8 +82,9 @@ class LumenScene {
 	std::vector<glm::vec2> texcoords1;
 	std::vector<glm::vec4> colors0;
 	std::vector<LumenPrimMesh> prim_meshes;
+	std::vector<LumenMeshInstance> mesh_instances;
 	std::vector<Material> materials;
-	std::vector<std::string> textures;
+	std::vector<LumenTexture> textures;
 	std::vector<LumenLight> lights;
 
 	struct Dimensions {
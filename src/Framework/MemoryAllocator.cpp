@@ -0,0 +1,243 @@
+#include "LumenPCH.h"
+#include "MemoryAllocator.h"
+#include <map>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+struct MemoryBlock {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	void* mapped = nullptr;
+	AllocationStrategy strategy;
+	uint32_t pool_key = 0;
+	uint32_t num_allocations = 0;
+	// FreeList: offset -> size of every free range, adjacent ranges are merged on release
+	std::map<VkDeviceSize, VkDeviceSize> free_ranges;
+	// Linear: first offset past the last allocation
+	VkDeviceSize head = 0;
+
+	bool try_allocate(VkDeviceSize alloc_size, VkDeviceSize alignment, VkDeviceSize& offset) {
+		if (strategy == AllocationStrategy::Linear) {
+			offset = align_up(head, alignment);
+			if (offset + alloc_size > size) {
+				return false;
+			}
+			head = offset + alloc_size;
+			num_allocations++;
+			return true;
+		}
+		for (auto it = free_ranges.begin(); it != free_ranges.end(); it++) {
+			const auto [range_offset, range_size] = *it;
+			offset = align_up(range_offset, alignment);
+			if (offset + alloc_size > range_offset + range_size) {
+				continue;
+			}
+			free_ranges.erase(it);
+			// The padding in front and the tail stay free
+			if (offset > range_offset) {
+				free_ranges[range_offset] = offset - range_offset;
+			}
+			if (offset + alloc_size < range_offset + range_size) {
+				free_ranges[offset + alloc_size] = range_offset + range_size - offset - alloc_size;
+			}
+			num_allocations++;
+			return true;
+		}
+		return false;
+	}
+
+	void release(VkDeviceSize offset, VkDeviceSize alloc_size) {
+		num_allocations--;
+		if (strategy == AllocationStrategy::Linear) {
+			if (num_allocations == 0) {
+				head = 0;
+			}
+			return;
+		}
+		auto it = free_ranges.emplace(offset, alloc_size).first;
+		auto next = std::next(it);
+		if (next != free_ranges.end() && it->first + it->second == next->first) {
+			it->second += next->second;
+			free_ranges.erase(next);
+		}
+		if (it != free_ranges.begin()) {
+			auto prev = std::prev(it);
+			if (prev->first + prev->second == it->first) {
+				prev->second += it->second;
+				free_ranges.erase(it);
+			}
+		}
+	}
+};
+
+MemoryAllocator::~MemoryAllocator() {}
+
+void MemoryAllocator::init(VulkanContext* ctx) { this->ctx = ctx; }
+
+void MemoryAllocator::destroy() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& [_, blocks] : pools) {
+		for (auto& block : blocks) {
+			if (block->num_allocations) {
+				LUMEN_WARN("Freeing a memory block with {} live allocations", block->num_allocations);
+			}
+			vkFreeMemory(ctx->device, block->memory, nullptr);
+		}
+	}
+	pools.clear();
+	LUMEN_TRACE("Memory allocator served {} allocations with {} device allocations", num_allocations,
+				num_device_allocations);
+}
+
+uint32_t MemoryAllocator::find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags props) const {
+	const auto& mem_props = ctx->memory_properties;
+	for (uint32_t i = 0; i < mem_props.memoryTypeCount; i++) {
+		if ((type_bits & (1 << i)) && (mem_props.memoryTypes[i].propertyFlags & props) == props) {
+			return i;
+		}
+	}
+	LUMEN_ERROR("Failed to find suitable memory type!");
+	return static_cast<uint32_t>(-1);
+}
+
+VkDeviceMemory MemoryAllocator::allocate_memory(VkDeviceSize size, uint32_t memory_type, bool for_images,
+												VkBuffer buffer, VkImage image, void** mapped) {
+	VkMemoryAllocateInfo alloc_info = vk::memory_allocate_info();
+	alloc_info.allocationSize = size;
+	alloc_info.memoryTypeIndex = memory_type;
+	// Every buffer may be queried for its device address, blocks for images don't need it
+	VkMemoryAllocateFlagsInfo flags_info{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO};
+	VkMemoryDedicatedAllocateInfo dedicated_info{VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO};
+	const void** next = &alloc_info.pNext;
+	if (!for_images) {
+		flags_info.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+		*next = &flags_info;
+		next = &flags_info.pNext;
+	}
+	if (buffer || image) {
+		dedicated_info.buffer = buffer;
+		dedicated_info.image = image;
+		*next = &dedicated_info;
+	}
+	VkDeviceMemory memory;
+	vk::check(vkAllocateMemory(ctx->device, &alloc_info, nullptr, &memory), "Failed to allocate device memory!");
+	num_device_allocations++;
+	*mapped = nullptr;
+	if (ctx->memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		// Host visible memory stays mapped for its whole lifetime, a block can't be mapped twice
+		vk::check(vkMapMemory(ctx->device, memory, 0, VK_WHOLE_SIZE, 0, mapped), "Unable to map memory");
+	}
+	return memory;
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements& reqs, bool dedicated,
+										   VkMemoryPropertyFlags props, AllocationStrategy strategy,
+										   VkBuffer buffer, VkImage image) {
+	const uint32_t memory_type = find_memory_type(reqs.memoryTypeBits, props);
+	const VkMemoryPropertyFlags type_flags = ctx->memory_properties.memoryTypes[memory_type].propertyFlags;
+	VkDeviceSize alignment = reqs.alignment;
+	VkDeviceSize size = reqs.size;
+	// Keeps flushes of non-coherent memory from touching neighbouring allocations
+	if ((type_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(type_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+		const VkDeviceSize atom_size = ctx->device_properties.limits.nonCoherentAtomSize;
+		alignment = std::max(alignment, atom_size);
+		size = align_up(size, atom_size);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	num_allocations++;
+	MemoryAllocation allocation;
+	allocation.size = size;
+	if (dedicated || size > DEDICATED_THRESHOLD) {
+		// The whole allocation belongs to the resource, so it has to match its size exactly
+		allocation.size = reqs.size;
+		allocation.memory = allocate_memory(reqs.size, memory_type, image != VK_NULL_HANDLE, buffer, image,
+										   &allocation.mapped);
+		return allocation;
+	}
+
+	const bool for_images = image != VK_NULL_HANDLE;
+	const uint32_t pool_key =
+		memory_type | (for_images ? 1 << 5 : 0) | (strategy == AllocationStrategy::Linear ? 1 << 6 : 0);
+	auto& blocks = pools[pool_key];
+	MemoryBlock* block = nullptr;
+	for (auto& candidate : blocks) {
+		if (candidate->try_allocate(size, alignment, allocation.offset)) {
+			block = candidate.get();
+			break;
+		}
+	}
+	if (!block) {
+		auto new_block = std::make_unique<MemoryBlock>();
+		new_block->size = BLOCK_SIZE;
+		new_block->strategy = strategy;
+		new_block->pool_key = pool_key;
+		new_block->memory =
+			allocate_memory(BLOCK_SIZE, memory_type, for_images, VK_NULL_HANDLE, VK_NULL_HANDLE, &new_block->mapped);
+		new_block->free_ranges[0] = BLOCK_SIZE;
+		new_block->try_allocate(size, alignment, allocation.offset);
+		LUMEN_TRACE("Allocated a {} MB block for memory type {}", BLOCK_SIZE >> 20, memory_type);
+		block = new_block.get();
+		blocks.push_back(std::move(new_block));
+	}
+	allocation.memory = block->memory;
+	allocation.block = block;
+	if (block->mapped) {
+		allocation.mapped = (uint8_t*)block->mapped + allocation.offset;
+	}
+	return allocation;
+}
+
+MemoryAllocation MemoryAllocator::allocate_buffer(VkBuffer buffer, VkMemoryPropertyFlags props,
+												  AllocationStrategy strategy) {
+	VkBufferMemoryRequirementsInfo2 info{VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2};
+	info.buffer = buffer;
+	VkMemoryDedicatedRequirements dedicated_reqs{VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS};
+	VkMemoryRequirements2 reqs{VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2};
+	reqs.pNext = &dedicated_reqs;
+	vkGetBufferMemoryRequirements2(ctx->device, &info, &reqs);
+	// Device addresses of shader binding tables and acceleration structure scratch
+	// memory need a stricter alignment than the buffer itself reports
+	reqs.memoryRequirements.alignment = std::max(reqs.memoryRequirements.alignment, BUFFER_ADDRESS_ALIGNMENT);
+	const bool dedicated = dedicated_reqs.prefersDedicatedAllocation || dedicated_reqs.requiresDedicatedAllocation;
+	return allocate(reqs.memoryRequirements, dedicated, props, strategy, buffer, VK_NULL_HANDLE);
+}
+
+MemoryAllocation MemoryAllocator::allocate_image(VkImage image, VkMemoryPropertyFlags props) {
+	VkImageMemoryRequirementsInfo2 info{VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2};
+	info.image = image;
+	VkMemoryDedicatedRequirements dedicated_reqs{VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS};
+	VkMemoryRequirements2 reqs{VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2};
+	reqs.pNext = &dedicated_reqs;
+	vkGetImageMemoryRequirements2(ctx->device, &info, &reqs);
+	const bool dedicated = dedicated_reqs.prefersDedicatedAllocation || dedicated_reqs.requiresDedicatedAllocation;
+	return allocate(reqs.memoryRequirements, dedicated, props, AllocationStrategy::FreeList, VK_NULL_HANDLE, image);
+}
+
+void MemoryAllocator::free(MemoryAllocation& allocation) {
+	if (!allocation.memory) {
+		return;
+	}
+	if (!allocation.block) {
+		vkFreeMemory(ctx->device, allocation.memory, nullptr);
+		allocation = {};
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	MemoryBlock* block = allocation.block;
+	block->release(allocation.offset, allocation.size);
+	// Keep one empty block per pool around so that load/free cycles don't hit the driver
+	if (block->num_allocations == 0) {
+		auto& blocks = pools[block->pool_key];
+		const bool has_other_empty = std::any_of(blocks.begin(), blocks.end(), [block](const auto& other) {
+			return other.get() != block && other->num_allocations == 0;
+		});
+		if (has_other_empty) {
+			vkFreeMemory(ctx->device, block->memory, nullptr);
+			std::erase_if(blocks, [block](const auto& other) { return other.get() == block; });
+		}
+	}
+	allocation = {};
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "LumenPCH.h"
+
+struct MemoryBlock;
+
+enum class AllocationStrategy {
+	// First fit from a list of free ranges, for resources that live as long as the scene
+	FreeList,
+	// Bump allocation, the block is reused once everything in it is freed. Meant for
+	// short-lived resources such as staging buffers
+	Linear,
+};
+
+// A range of device memory handed out by the MemoryAllocator
+struct MemoryAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	// Start of the allocation in host memory, null unless the memory is host visible
+	void* mapped = nullptr;
+	// Null for dedicated allocations
+	MemoryBlock* block = nullptr;
+};
+
+// Sub-allocates buffers and images from large VkDeviceMemory blocks. Blocks are
+// kept per memory type, resource kind and strategy so that buffers and optimal
+// images never share a block and bufferImageGranularity can be ignored. Resources
+// the driver prefers to own their memory, or that would take up most of a block,
+// get a dedicated allocation instead.
+class MemoryAllocator {
+   public:
+	static constexpr VkDeviceSize BLOCK_SIZE = 64 * 1024 * 1024;
+	static constexpr VkDeviceSize DEDICATED_THRESHOLD = BLOCK_SIZE / 2;
+	static constexpr VkDeviceSize BUFFER_ADDRESS_ALIGNMENT = 256;
+
+	MemoryAllocator() = default;
+	~MemoryAllocator();
+	void init(VulkanContext* ctx);
+	void destroy();
+	// Allocates memory for the resource, binding it is left to the caller
+	MemoryAllocation allocate_buffer(VkBuffer buffer, VkMemoryPropertyFlags props,
+									 AllocationStrategy strategy = AllocationStrategy::FreeList);
+	MemoryAllocation allocate_image(VkImage image, VkMemoryPropertyFlags props);
+	void free(MemoryAllocation& allocation);
+
+   private:
+	MemoryAllocation allocate(const VkMemoryRequirements& reqs, bool dedicated, VkMemoryPropertyFlags props,
+							  AllocationStrategy strategy, VkBuffer buffer, VkImage image);
+	// The buffer or image is only given for dedicated allocations
+	VkDeviceMemory allocate_memory(VkDeviceSize size, uint32_t memory_type, bool for_images, VkBuffer buffer,
+								   VkImage image, void** mapped);
+	uint32_t find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags props) const;
+
+	VulkanContext* ctx = nullptr;
+	std::mutex mutex;
+	// Key combines the memory type, whether the pool holds images and the strategy
+	std::unordered_map<uint32_t, std::vector<std::unique_ptr<MemoryBlock>>> pools;
+	uint32_t num_device_allocations = 0;
+	uint32_t num_allocations = 0;
+};
@@ -151,7 +151,7 @@ void Pipeline::create_gfx_pipeline(const GraphicsPassSettings& settings, const s
 	pipeline_CI.basePipelineHandle = VK_NULL_HANDLE;
 	pipeline_CI.pDepthStencilState = &depth_stencil_state_ci;
 
-	vk::check(vkCreateGraphicsPipelines(ctx->device, VK_NULL_HANDLE, 1, &pipeline_CI, nullptr, &handle),
+	vk::check(vkCreateGraphicsPipelines(ctx->device, ctx->pipeline_cache, 1, &pipeline_CI, nullptr, &handle),
 			  "Failed to create pipeline");
 	for (auto& stage : stages) {
 		vkDestroyShaderModule(ctx->device, stage.module, nullptr);
@@ -255,7 +255,7 @@ void Pipeline::create_rt_pipeline(const RTPassSettings& settings, const std::vec
 	pipeline_CI.maxPipelineRayRecursionDepth = settings.recursion_depth;
 	pipeline_CI.layout = pipeline_layout;
 	pipeline_CI.flags = 0;
-	vkCreateRayTracingPipelinesKHR(ctx->device, {}, {}, 1, &pipeline_CI, nullptr, &handle);
+	vkCreateRayTracingPipelinesKHR(ctx->device, {}, ctx->pipeline_cache, 1, &pipeline_CI, nullptr, &handle);
 	sbt_wrapper.setup(ctx, ctx->indices.gfx_family.value(), ctx->rt_props);
 	sbt_wrapper.create(handle, pipeline_CI);
 	if (!name.empty()) {
@@ -303,7 +303,7 @@ void Pipeline::create_compute_pipeline(const ComputePassSettings& settings,
 	pipeline_CI.stage = shader_stage_ci;
 	pipeline_CI.flags |= VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
 	pipeline_CI.layout = pipeline_layout;
-	vk::check(vkCreateComputePipelines(ctx->device, VK_NULL_HANDLE, 1, &pipeline_CI, nullptr, &handle));
+	vk::check(vkCreateComputePipelines(ctx->device, ctx->pipeline_cache, 1, &pipeline_CI, nullptr, &handle));
 	vkDestroyShaderModule(ctx->device, compute_shader_module, nullptr);
 	if (!name.empty()) {
 		DebugMarker::set_resource_name(ctx->device, (uint64_t)handle, name.c_str(), VK_OBJECT_TYPE_PIPELINE);
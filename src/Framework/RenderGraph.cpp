@@ -7,6 +7,9 @@
 // doesn't show any output from the debugPrintf...
 // Possible solution: Make compilation with debugPrintf shaders synchronous?
 
+// Frames a replaced pipeline is kept alive for, matches MAX_FRAMES_IN_FLIGHT
+static constexpr uint32_t PIPELINE_RETIRE_FRAMES = 3;
+
 #define DIRTY_CHECK(x) \
 	if (!(x)) {          \
 		return *this;  \
@@ -158,28 +161,48 @@ void RenderPass::transition_resources() {
 
 }
 
-static void build_shaders(RenderPass* pass, const std::vector<Shader*>& active_shaders) {
-	// todo: make resource processing in order
-	auto process_resources = [pass](const Shader& shader) {
-		if (!pass->rg->settings.shader_inference) {
-			return;
+static void process_resources(RenderPass* pass, const Shader& shader) {
+	if (!pass->rg->settings.shader_inference) {
+		return;
+	}
+	for (auto& [k, v] : shader.buffer_status_map) {
+		if (v.read) {
+			pass->affected_buffer_pointers[k].read = v.read;
 		}
-		for (auto& [k, v] : shader.buffer_status_map) {
-			if (v.read) {
-				pass->affected_buffer_pointers[k].read = v.read;
-			}
-			if (v.write) {
-				pass->affected_buffer_pointers[k].write = v.write;
-			}
+		if (v.write) {
+			pass->affected_buffer_pointers[k].write = v.write;
 		}
-	};
+	}
+}
+
+static void update_tlas_descriptor(VulkanContext* ctx, Pipeline* pipeline) {
+	// Create descriptor pool and sets
+	if (!pipeline->tlas_descriptor_pool) {
+		auto pool_size = vk::descriptor_pool_size(VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1);
+		auto descriptor_pool_ci = vk::descriptor_pool_CI(1, &pool_size, 1);
+
+		vk::check(vkCreateDescriptorPool(ctx->device, &descriptor_pool_ci, nullptr, &pipeline->tlas_descriptor_pool),
+				  "Failed to create descriptor pool");
+		VkDescriptorSetAllocateInfo set_allocate_info{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+		set_allocate_info.descriptorPool = pipeline->tlas_descriptor_pool;
+		set_allocate_info.descriptorSetCount = 1;
+		set_allocate_info.pSetLayouts = &pipeline->tlas_layout;
+		vkAllocateDescriptorSets(ctx->device, &set_allocate_info, &pipeline->tlas_descriptor_set);
+	}
+	auto descriptor_write = vk::write_descriptor_set(
+		pipeline->tlas_descriptor_set, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 0, &pipeline->tlas_info);
+	vkUpdateDescriptorSets(ctx->device, 1, &descriptor_write, 0, nullptr);
+}
+
+static void build_shaders(RenderPass* pass, const std::vector<Shader*>& active_shaders) {
+	// todo: make resource processing in order
 	switch (pass->type) {
 		case PassType::Graphics: {
 			std::vector<std::future<Shader*>> shader_tasks;
 			shader_tasks.reserve(pass->gfx_settings->shaders.size());
 			for (auto& shader : active_shaders) {
-				if (pass->rg->shader_cache.find(shader->filename) != pass->rg->shader_cache.end()) {
-					*shader = pass->rg->shader_cache[shader->filename];
+				if (pass->rg->shader_cache.find(shader->get_variant_key()) != pass->rg->shader_cache.end()) {
+					*shader = pass->rg->shader_cache[shader->get_variant_key()];
 				} else {
 					shader_tasks.push_back(ThreadPool::submit(
 						[pass](Shader* shader) {
@@ -193,19 +216,19 @@ static void build_shaders(RenderPass* pass, const std::vector<Shader*>& active_s
 				auto shader = task.get();
 				{
 					std::lock_guard<std::mutex> lock(pass->rg->shader_map_mutex);
-					pass->rg->shader_cache[shader->filename] = *shader;
+					pass->rg->shader_cache[shader->get_variant_key()] = *shader;
 				}
 			}
 			for (auto& shader : active_shaders) {
-				process_resources(*shader);
+				process_resources(pass, *shader);
 			}
 		} break;
 		case PassType::RT: {
 			std::vector<std::future<Shader*>> shader_tasks;
 			shader_tasks.reserve(pass->rt_settings->shaders.size());
 			for (auto& shader : active_shaders) {
-				if (pass->rg->shader_cache.find(shader->filename) != pass->rg->shader_cache.end()) {
-					*shader = pass->rg->shader_cache[shader->filename];
+				if (pass->rg->shader_cache.find(shader->get_variant_key()) != pass->rg->shader_cache.end()) {
+					*shader = pass->rg->shader_cache[shader->get_variant_key()];
 				} else {
 					shader_tasks.push_back(ThreadPool::submit(
 						[pass](Shader* shader) {
@@ -214,30 +237,30 @@ static void build_shaders(RenderPass* pass, const std::vector<Shader*>& active_s
 						},
 						shader));
 					// shader.compile(this);
-					pass->rg->shader_cache[shader->filename] = *shader;
+					pass->rg->shader_cache[shader->get_variant_key()] = *shader;
 				}
 			}
 			for (auto& task : shader_tasks) {
 				auto shader = task.get();
 				{
 					std::lock_guard<std::mutex> lock(pass->rg->shader_map_mutex);
-					pass->rg->shader_cache[shader->filename] = *shader;
+					pass->rg->shader_cache[shader->get_variant_key()] = *shader;
 				}
 			}
 			for (auto& shader : active_shaders) {
-				process_resources(*shader);
+				process_resources(pass, *shader);
 			}
 
 		} break;
 		case PassType::Compute: {
 			for (auto& shader : active_shaders) {
-				if (pass->rg->shader_cache.find(shader->filename) != pass->rg->shader_cache.end()) {
-					*shader = pass->rg->shader_cache[shader->filename];
+				if (pass->rg->shader_cache.find(shader->get_variant_key()) != pass->rg->shader_cache.end()) {
+					*shader = pass->rg->shader_cache[shader->get_variant_key()];
 				} else {
 					shader->compile(pass);
 					{
 						std::lock_guard<std::mutex> lock(pass->rg->shader_map_mutex);
-						pass->rg->shader_cache[shader->filename] = *shader;
+						pass->rg->shader_cache[shader->get_variant_key()] = *shader;
 					}
 				}
 				pass->affected_buffer_pointers = shader->buffer_status_map;
@@ -452,27 +475,12 @@ void RenderPass::finalize() {
 			case PassType::RT: {
 				auto func = [](RenderPass* pass) {
 					pass->pipeline->create_rt_pipeline(*pass->rt_settings, pass->descriptor_counts);
-					// Create descriptor pool and sets
-					if (!pass->pipeline->tlas_descriptor_pool) {
-						auto pool_size = vk::descriptor_pool_size(VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1);
-						auto descriptor_pool_ci = vk::descriptor_pool_CI(1, &pool_size, 1);
-
-						vk::check(vkCreateDescriptorPool(pass->rg->ctx->device, &descriptor_pool_ci, nullptr,
-														 &pass->pipeline->tlas_descriptor_pool),
-								  "Failed to create descriptor pool");
-						VkDescriptorSetAllocateInfo set_allocate_info{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
-						set_allocate_info.descriptorPool = pass->pipeline->tlas_descriptor_pool;
-						set_allocate_info.descriptorSetCount = 1;
-						set_allocate_info.pSetLayouts = &pass->pipeline->tlas_layout;
-						vkAllocateDescriptorSets(pass->rg->ctx->device, &set_allocate_info, &pass->pipeline->tlas_descriptor_set);
-					}
-					auto descriptor_write = vk::write_descriptor_set(
-						pass->pipeline->tlas_descriptor_set, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 0, &pass->pipeline->tlas_info);
-					vkUpdateDescriptorSets(pass->rg->ctx->device, 1, &descriptor_write, 0, nullptr);
+					update_tlas_descriptor(pass->rg->ctx, pass->pipeline);
 				};
-				// TODO: Fix multithreaded pipeline building for RT
-				 //func(this);
-				rg->pipeline_tasks.push_back({func, pass_idx});
+				// RT pipelines are built on the recording thread, creating the SBT
+				// isn't safe to do concurrently
+				func(this);
+				rg->pipeline_tasks.push_back({nullptr, pass_idx});
 				break;
 			}
 			case PassType::Compute: {
@@ -487,6 +495,10 @@ void RenderPass::finalize() {
 				break;
 		}
 	} else {
+		if (type == PassType::RT && pipeline->tlas_descriptor_pool) {
+			// The cached pipeline may have been built for the TLAS of an earlier scene
+			update_tlas_descriptor(rg->ctx, pipeline);
+		}
 		rg->pipeline_tasks.push_back({ nullptr , pass_idx});
 	}
 }
@@ -789,7 +801,7 @@ void RenderGraph::run(VkCommandBuffer cmd) {
 	// Compile shaders and process resources
 	if (recording || reload_shaders) {
 		auto cmp = [](const std::pair<Shader*, RenderPass*>& a, const std::pair<Shader*, RenderPass*>& b) {
-			return a.first->filename < b.first->filename;
+			return std::tie(a.first->filename, a.first->defines) < std::tie(b.first->filename, b.first->defines);
 		};
 		std::set<std::pair<Shader*, RenderPass*>, decltype(cmp)> unique_shaders_set;
 		std::unordered_map<RenderPass*, std::vector<Shader*>> unique_shaders;
@@ -834,6 +846,9 @@ void RenderGraph::run(VkCommandBuffer cmd) {
 		for (auto& future : futures) {
 			future.wait();
 		}
+		for (const auto& [_, shader] : shader_cache) {
+			track_shader_includes(shader);
+		}
 	}
 	uint32_t i = beginning_pass_idx;
 	uint32_t rem_passes = ending_pass_idx - beginning_pass_idx;
@@ -919,6 +934,271 @@ void RenderGraph::reset(VkCommandBuffer cmd) {
 	img_sync_resources.clear();
 	beginning_pass_idx = ending_pass_idx = 0;
 	reload_shaders = false;
+
+	for (auto it = retired_pipelines.begin(); it != retired_pipelines.end();) {
+		if (--it->second == 0) {
+			it->first->cleanup();
+			it = retired_pipelines.erase(it);
+		} else {
+			++it;
+		}
+	}
+	update_shader_reload();
+}
+
+void RenderGraph::validate_cached_pipeline(RenderPass& pass, bool cached) {
+	std::string variant_key;
+	auto add_key = [&variant_key](const Shader& shader) { variant_key += shader.get_variant_key() + ";"; };
+	if (pass.compute_settings) {
+		add_key(pass.compute_settings->shader);
+	} else if (pass.gfx_settings) {
+		std::for_each(pass.gfx_settings->shaders.begin(), pass.gfx_settings->shaders.end(), add_key);
+	} else {
+		std::for_each(pass.rt_settings->shaders.begin(), pass.rt_settings->shaders.end(), add_key);
+	}
+	auto& storage = pipeline_cache[pass.name];
+	// A pass recorded after clear_passes() may share its name with one built from other defines
+	if (cached && storage.variant_key != variant_key) {
+		retired_pipelines.push_back({std::move(storage.pipeline), PIPELINE_RETIRE_FRAMES});
+		storage.pipeline = std::make_unique<Pipeline>(ctx, pass.name);
+		pass.pipeline = storage.pipeline.get();
+		pass.is_pipeline_cached = false;
+	}
+	storage.variant_key = std::move(variant_key);
+}
+
+void RenderGraph::clear_passes() {
+	for (auto& pass : passes) {
+		if (pass.push_constant_data) {
+			free(pass.push_constant_data);
+		}
+	}
+	passes.clear();
+	for (auto& [_, storage] : pipeline_cache) {
+		storage.pass_idxs.clear();
+		storage.offset_idx = 0;
+	}
+	// Registered pointers may belong to destroyed resources, their owners register them again
+	registered_buffer_pointers.clear();
+	buffer_resource_map.clear();
+	img_resource_map.clear();
+	recording = true;
+}
+
+void RenderGraph::track_shader_includes(const Shader& shader) {
+	auto track = [this, &shader](const std::string& file) {
+		shader_dependents[file].insert(shader.get_variant_key());
+		if (shader_file_times.find(file) == shader_file_times.end()) {
+			std::error_code ec;
+			auto write_time = std::filesystem::last_write_time(file, ec);
+			if (!ec) {
+				shader_file_times[file] = write_time;
+			}
+		}
+	};
+	track(shader.filename);
+	for (const auto& include : shader.includes) {
+		track(include);
+	}
+}
+
+void RenderGraph::request_shader_reload() {
+	if (!shader_reload.dirty_shaders.empty()) {
+		LUMEN_TRACE("Shader reload already in progress");
+		return;
+	}
+	// Walk the include graph from every modified file to the shaders depending on it
+	for (auto& [file, write_time] : shader_file_times) {
+		std::error_code ec;
+		auto curr_write_time = std::filesystem::last_write_time(file, ec);
+		if (ec || curr_write_time == write_time) {
+			continue;
+		}
+		// The write time is committed once the dependents compiled, so that a
+		// failed compile is retried on the next request
+		shader_reload.changed_files[file] = curr_write_time;
+		const auto& dependents = shader_dependents[file];
+		shader_reload.dirty_shaders.insert(dependents.begin(), dependents.end());
+	}
+	if (shader_reload.dirty_shaders.empty()) {
+		LUMEN_TRACE("Shaders are up to date");
+		return;
+	}
+	for (const auto& key : shader_reload.dirty_shaders) {
+		const Shader& cached = shader_cache[key];
+		shader_reload.shader_tasks.push_back(ThreadPool::submit(
+			[](const std::string& filename, const ShaderDefines& defines) {
+				Shader shader(filename, defines);
+				// The bundle can't contain the edits being reloaded
+				shader.compile(nullptr, false);
+				return shader;
+			},
+			cached.filename, cached.defines));
+	}
+}
+
+void RenderGraph::build_reloaded_pipelines() {
+	// Replaces the shaders of a copied pass setting, returns false if the
+	// pipeline doesn't need a rebuild or one of its shaders failed to compile
+	auto replace_shaders = [this](std::vector<Shader>& shaders) {
+		bool dirty = false;
+		for (auto& shader : shaders) {
+			const std::string key = shader.get_variant_key();
+			if (shader_reload.dirty_shaders.find(key) == shader_reload.dirty_shaders.end()) {
+				continue;
+			}
+			auto it = shader_reload.compiled_shaders.find(key);
+			if (it == shader_reload.compiled_shaders.end()) {
+				return false;
+			}
+			shader = it->second;
+			dirty = true;
+		}
+		return dirty;
+	};
+	for (const auto& [name, storage] : pipeline_cache) {
+		if (storage.pass_idxs.empty()) {
+			continue;
+		}
+		const RenderPass& pass = passes[storage.pass_idxs[0]];
+		std::future<std::unique_ptr<Pipeline>> task;
+		switch (pass.type) {
+			case PassType::Graphics: {
+				GraphicsPassSettings settings = *pass.gfx_settings;
+				if (!replace_shaders(settings.shaders)) {
+					continue;
+				}
+				task = ThreadPool::submit([ctx = ctx, name = name, settings = std::move(settings),
+										   descriptor_counts = pass.descriptor_counts]() {
+					auto pipeline = std::make_unique<Pipeline>(ctx, name);
+					pipeline->create_gfx_pipeline(settings, descriptor_counts, settings.color_outputs,
+												  settings.depth_output);
+					return pipeline;
+				});
+				break;
+			}
+			case PassType::RT: {
+				RTPassSettings settings = *pass.rt_settings;
+				if (!replace_shaders(settings.shaders)) {
+					continue;
+				}
+				// Built on this thread like in RenderPass::finalize()
+				std::packaged_task<std::unique_ptr<Pipeline>()> build(
+					[ctx = ctx, name = name, settings = std::move(settings),
+					 descriptor_counts = pass.descriptor_counts, tlas_info = pass.pipeline->tlas_info]() {
+						auto pipeline = std::make_unique<Pipeline>(ctx, name);
+						pipeline->create_rt_pipeline(settings, descriptor_counts);
+						pipeline->tlas_info = tlas_info;
+						update_tlas_descriptor(ctx, pipeline.get());
+						return pipeline;
+					});
+				task = build.get_future();
+				build();
+				break;
+			}
+			case PassType::Compute: {
+				ComputePassSettings settings = *pass.compute_settings;
+				std::vector<Shader> shaders = {settings.shader};
+				if (!replace_shaders(shaders)) {
+					continue;
+				}
+				settings.shader = std::move(shaders[0]);
+				task = ThreadPool::submit([ctx = ctx, name = name, settings = std::move(settings),
+										   descriptor_counts = pass.descriptor_counts]() {
+					auto pipeline = std::make_unique<Pipeline>(ctx, name);
+					pipeline->create_compute_pipeline(settings, descriptor_counts);
+					return pipeline;
+				});
+				break;
+			}
+			default:
+				continue;
+		}
+		shader_reload.pipeline_tasks.push_back({name, std::move(task)});
+	}
+}
+
+void RenderGraph::update_shader_reload() {
+	auto is_ready = [](const auto& future) {
+		return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	};
+	if (!shader_reload.shader_tasks.empty()) {
+		if (!std::all_of(shader_reload.shader_tasks.begin(), shader_reload.shader_tasks.end(), is_ready)) {
+			return;
+		}
+		for (auto& task : shader_reload.shader_tasks) {
+			Shader shader = task.get();
+			if (shader.binary.empty()) {
+				LUMEN_WARN("Failed to compile {}, keeping the previous pipelines", shader.filename);
+				continue;
+			}
+			track_shader_includes(shader);
+			shader_reload.compiled_shaders[shader.get_variant_key()] = std::move(shader);
+		}
+		shader_reload.shader_tasks.clear();
+		// Files with a dependent that failed keep their old write time and are retried
+		for (const auto& [file, write_time] : shader_reload.changed_files) {
+			const auto& dependents = shader_dependents[file];
+			if (std::all_of(dependents.begin(), dependents.end(), [this](const std::string& key) {
+					return shader_reload.compiled_shaders.count(key) != 0;
+				})) {
+				shader_file_times[file] = write_time;
+			}
+		}
+		build_reloaded_pipelines();
+	}
+	if (shader_reload.dirty_shaders.empty() ||
+		!std::all_of(shader_reload.pipeline_tasks.begin(), shader_reload.pipeline_tasks.end(),
+					 [&](const auto& task) { return is_ready(task.second); })) {
+		return;
+	}
+
+	// Swap the rebuilt pipelines in, the old ones may still be used by frames in flight
+	auto update_shader = [this](RenderPass& pass, Shader& shader) {
+		auto it = shader_reload.compiled_shaders.find(shader.get_variant_key());
+		if (it == shader_reload.compiled_shaders.end()) {
+			return;
+		}
+		shader = it->second;
+		shader.infer_resources(&pass);
+		process_resources(&pass, shader);
+	};
+	for (auto& [name, task] : shader_reload.pipeline_tasks) {
+		std::unique_ptr<Pipeline> pipeline;
+		try {
+			pipeline = task.get();
+		} catch (const std::exception& e) {
+			LUMEN_WARN("Failed to rebuild pipeline {}: {}", name, e.what());
+			continue;
+		}
+		auto& storage = pipeline_cache[name];
+		retired_pipelines.push_back({std::move(storage.pipeline), PIPELINE_RETIRE_FRAMES});
+		storage.pipeline = std::move(pipeline);
+		for (auto idx : storage.pass_idxs) {
+			auto& pass = passes[idx];
+			pass.pipeline = storage.pipeline.get();
+			if (pass.gfx_settings) {
+				for (auto& shader : pass.gfx_settings->shaders) {
+					update_shader(pass, shader);
+				}
+			} else if (pass.rt_settings) {
+				for (auto& shader : pass.rt_settings->shaders) {
+					update_shader(pass, shader);
+				}
+			} else {
+				update_shader(pass, pass.compute_settings->shader);
+			}
+		}
+		shaders_reloaded = true;
+		LUMEN_TRACE("Reloaded pipeline {}", name);
+	}
+	{
+		std::lock_guard<std::mutex> lock(shader_map_mutex);
+		for (auto& [key, shader] : shader_reload.compiled_shaders) {
+			shader_cache[key] = std::move(shader);
+		}
+	}
+	shader_reload = {};
 }
 
 void RenderGraph::submit(CommandBuffer& cmd) {
@@ -947,6 +1227,18 @@ void RenderGraph::destroy() {
 			free(pass.push_constant_data);
 		}
 	}
+	for (auto& task : shader_reload.shader_tasks) {
+		task.wait();
+	}
+	for (auto& [_, task] : shader_reload.pipeline_tasks) {
+		try {
+			task.get()->cleanup();
+		} catch (const std::exception&) {
+		}
+	}
+	for (const auto& [pipeline, _] : retired_pipelines) {
+		pipeline->cleanup();
+	}
 	for (const auto& [k, v] : pipeline_cache) {
 		v.pipeline->cleanup();
 	}
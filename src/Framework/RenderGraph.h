@@ -6,6 +6,7 @@
 #include "Framework/Texture.h"
 #include "Framework/EventPool.h"
 #include "Framework/RenderGraphTypes.h"
+#include <unordered_set>
 
 #define TO_STR(V) (#V)
 
@@ -37,10 +38,21 @@ public:
 	void reset(VkCommandBuffer cmd);
 	void submit(CommandBuffer& cmd);
 	void run_and_submit(CommandBuffer& cmd);
+	// Recompiles the shaders whose sources or includes changed since they were
+	// built and rebuilds the affected pipelines, on the thread pool except for RT
+	// pipelines. Passes keep using their current pipelines until run() swaps the
+	// new ones in
+	void request_shader_reload();
+	// Drops the recorded passes so that the next run() records them again, for when the
+	// resources they bind were recreated. Pipelines and compiled shaders are kept and
+	// reused by passes with the same name and shader variants. Expects the GPU to be idle
+	void clear_passes();
 	void destroy();
 	friend RenderPass;
 	bool recording = true;
 	bool reload_shaders = false;
+	// Set when reset() swapped in pipelines from request_shader_reload()
+	bool shaders_reloaded = false;
 	EventPool event_pool;
 	std::unordered_map<std::string, Buffer*> registered_buffer_pointers;
 	std::unordered_map<std::string, Shader> shader_cache;
@@ -61,12 +73,33 @@ private:
 		std::unique_ptr<Pipeline> pipeline;
 		uint32_t offset_idx;
 		std::vector<uint32_t> pass_idxs;
+		// Shader variants the pipeline was built from
+		std::string variant_key;
 	};
+	struct ShaderReload {
+		std::unordered_set<std::string> dirty_shaders;
+		// Modified files and their new write times
+		std::unordered_map<std::string, std::filesystem::file_time_type> changed_files;
+		std::vector<std::future<Shader>> shader_tasks;
+		std::unordered_map<std::string, Shader> compiled_shaders;
+		std::vector<std::pair<std::string, std::future<std::unique_ptr<Pipeline>>>> pipeline_tasks;
+	};
+	void track_shader_includes(const Shader& shader);
+	// Replaces the cached pipeline of a newly recorded pass if its shader variants changed
+	void validate_cached_pipeline(RenderPass& pass, bool cached);
+	void build_reloaded_pipelines();
+	void update_shader_reload();
 	VulkanContext* ctx = nullptr;
 	std::vector<RenderPass> passes;
 	std::unordered_map<std::string, PipelineStorage> pipeline_cache;
 	std::vector<std::pair<std::function<void(RenderPass*)>, uint32_t>> pipeline_tasks;
 	std::vector<std::function<void(RenderPass*)>> shader_tasks;
+	// Include graph: file -> variants of the shaders depending on it, and its write time when last built
+	std::unordered_map<std::string, std::unordered_set<std::string>> shader_dependents;
+	std::unordered_map<std::string, std::filesystem::file_time_type> shader_file_times;
+	ShaderReload shader_reload;
+	// Replaced pipelines, destroyed once no frame in flight can reference them
+	std::vector<std::pair<std::unique_ptr<Pipeline>, uint32_t>> retired_pipelines;
 	// Sync related data
 	std::vector<BufferSyncResources> buffer_sync_resources;
 	std::vector<ImageSyncResources> img_sync_resources;
@@ -245,7 +278,25 @@ inline RenderPass& RenderGraph::add_pass_impl(const std::string& name, const Set
 		type = PassType::RT;
 	}
 	passes.emplace_back(type, pipeline, name, this, pass_idx, settings, cached);
-	return passes.back();
+	auto& pass = passes.back();
+	// Shader variants are resolved once while recording, replayed passes keep their pipelines
+	if (!recording) {
+		return pass;
+	}
+	// Global defines only fill in what the shader doesn't set itself
+	const auto& global_defines = this->settings.shader_defines;
+	auto add_defines = [&global_defines](Shader& shader) {
+		shader.defines.insert(global_defines.begin(), global_defines.end());
+	};
+	if constexpr (std::is_same_v<ComputePassSettings, Settings>) {
+		add_defines(pass.compute_settings->shader);
+	} else if constexpr (std::is_same_v<GraphicsPassSettings, Settings>) {
+		std::for_each(pass.gfx_settings->shaders.begin(), pass.gfx_settings->shaders.end(), add_defines);
+	} else {
+		std::for_each(pass.rt_settings->shaders.begin(), pass.rt_settings->shaders.end(), add_defines);
+	}
+	validate_cached_pipeline(pass, cached);
+	return pass;
 }
 
 template<typename T>
@@ -14,6 +14,9 @@ class RenderPass;
 struct RenderGraphSettings {
 	bool shader_inference = false;
 	bool use_events = false;
+	// Added to every shader of the graph, defines set on the shader itself take precedence.
+	// Only read while the graph records, changes take effect after clear_passes()
+	ShaderDefines shader_defines;
 };
 
 struct GraphicsPassSettings {
@@ -0,0 +1,356 @@
+#include "LumenPCH.h"
+#include "SceneCache.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Bump whenever the layout below or the loader output changes
+static constexpr uint32_t SCENE_CACHE_VERSION = 5;
+static constexpr char SCENE_CACHE_MAGIC[4] = {'L', 'S', 'C', 'H'};
+
+// Material contents depend on the material mapping the host was compiled with
+static constexpr uint32_t SCENE_CACHE_BUILD_FLAGS = (uint32_t)MATERIAL_MAPPING;
+
+struct SceneCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t build_flags;
+	uint32_t vec3_size;
+	uint32_t prim_mesh_size;
+	uint32_t material_size;
+	uint32_t light_size;
+	uint32_t num_sources;
+};
+
+// Read-only view of a whole file
+class MappedFile {
+   public:
+	MappedFile(const std::string& path) {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+						   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return;
+		}
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+			return;
+		}
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping) {
+			return;
+		}
+		data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		size = data ? (size_t)file_size.QuadPart : 0;
+#else
+		fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			return;
+		}
+		void* ptr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ptr == MAP_FAILED) {
+			return;
+		}
+		data = (const uint8_t*)ptr;
+		size = (size_t)st.st_size;
+#endif
+	}
+
+	~MappedFile() {
+#ifdef _WIN32
+		if (data) UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+		if (data) munmap((void*)data, size);
+		if (fd >= 0) close(fd);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+   private:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
+
+// Bounds checked cursor over the mapped cache. Arrays are copied with a single
+// memcpy each, the on-disk layout is the in-memory layout
+struct CacheReader {
+	const uint8_t* ptr;
+	const uint8_t* end;
+	bool ok = true;
+
+	bool read_bytes(void* dst, size_t size) {
+		if (!ok || size_t(end - ptr) < size) {
+			ok = false;
+			return false;
+		}
+		memcpy(dst, ptr, size);
+		ptr += size;
+		return true;
+	}
+
+	template <typename T>
+	bool read(T& val) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		return read_bytes(&val, sizeof(T));
+	}
+
+	template <typename T>
+	bool read_array(std::vector<T>& arr) {
+		uint64_t count = 0;
+		if (!read(count) || count > size_t(end - ptr) / sizeof(T)) {
+			ok = false;
+			return false;
+		}
+		arr.resize(count);
+		return read_bytes(arr.data(), count * sizeof(T));
+	}
+
+	bool read_string(std::string& str) {
+		uint32_t len = 0;
+		if (!read(len) || len > size_t(end - ptr)) {
+			ok = false;
+			return false;
+		}
+		str.assign((const char*)ptr, len);
+		ptr += len;
+		return true;
+	}
+};
+
+struct CacheWriter {
+	std::ofstream& out;
+
+	template <typename T>
+	void write(const T& val) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		out.write((const char*)&val, sizeof(T));
+	}
+
+	template <typename T>
+	void write_array(const std::vector<T>& arr) {
+		write((uint64_t)arr.size());
+		out.write((const char*)arr.data(), arr.size() * sizeof(T));
+	}
+
+	void write_string(const std::string& str) {
+		write((uint32_t)str.size());
+		out.write(str.data(), str.size());
+	}
+};
+
+static bool get_file_stamp(const std::string& path, uint64_t& size, int64_t& mtime) {
+	std::error_code ec;
+	size = std::filesystem::file_size(path, ec);
+	if (ec) {
+		return false;
+	}
+	auto time = std::filesystem::last_write_time(path, ec);
+	if (ec) {
+		return false;
+	}
+	mtime = (int64_t)time.time_since_epoch().count();
+	return true;
+}
+
+bool SceneCache::load(const std::string& cache_path, LumenScene& scene) {
+	MappedFile file(cache_path);
+	if (!file.data) {
+		return false;
+	}
+	CacheReader reader{file.data, file.data + file.size};
+
+	SceneCacheHeader header;
+	if (!reader.read(header) || memcmp(header.magic, SCENE_CACHE_MAGIC, sizeof(SCENE_CACHE_MAGIC)) != 0 ||
+		header.version != SCENE_CACHE_VERSION || header.build_flags != SCENE_CACHE_BUILD_FLAGS ||
+		header.vec3_size != sizeof(glm::vec3) || header.prim_mesh_size != sizeof(LumenPrimMesh) ||
+		header.material_size != sizeof(Material) || header.light_size != sizeof(LumenLight)) {
+		LUMEN_TRACE("Scene cache {} is outdated", cache_path);
+		return false;
+	}
+
+	for (uint32_t i = 0; i < header.num_sources; i++) {
+		std::string source;
+		uint64_t size, cached_size;
+		int64_t mtime, cached_mtime;
+		if (!reader.read_string(source) || !reader.read(cached_size) || !reader.read(cached_mtime)) {
+			return false;
+		}
+		if (!get_file_stamp(source, size, mtime) || size != cached_size || mtime != cached_mtime) {
+			LUMEN_TRACE("Scene cache {} is stale: {} changed", cache_path, source);
+			return false;
+		}
+	}
+
+	// Decode into a temporary so that a truncated cache leaves the scene untouched
+	LumenScene cached;
+	auto& config = cached.config;
+	reader.read(config.integrator_type);
+	reader.read(config.path_length);
+	reader.read(config.sky_col);
+	reader.read(config.cam_settings);
+	reader.read(config.base_radius);
+	reader.read(config.radius_factor);
+	reader.read(config.mutations_per_pixel);
+	reader.read(config.num_bootstrap_samples);
+	reader.read(config.num_mlt_threads);
+	reader.read(config.enable_vm);
+	reader.read(config.light_first);
+	reader.read(config.alternate);
+	reader.read_string(config.integrator_name);
+	reader.read(cached.m_dimensions);
+
+	reader.read_array(cached.positions);
+	reader.read_array(cached.indices);
+	reader.read_array(cached.normals);
+	reader.read_array(cached.texcoords0);
+	reader.read_array(cached.materials);
+	reader.read_array(cached.lights);
+	reader.read_array(cached.mesh_instances);
+
+	uint64_t num_prim_meshes = 0;
+	reader.read(num_prim_meshes);
+	if (reader.ok && num_prim_meshes <= file.size) {
+		cached.prim_meshes.resize(num_prim_meshes);
+		for (auto& pm : cached.prim_meshes) {
+			reader.read_string(pm.name);
+			reader.read(pm.material_idx);
+			reader.read(pm.vtx_offset);
+			reader.read(pm.first_idx);
+			reader.read(pm.idx_count);
+			reader.read(pm.vtx_count);
+			reader.read(pm.prim_idx);
+			reader.read(pm.min_pos);
+			reader.read(pm.max_pos);
+		}
+	}
+
+	uint64_t num_textures = 0;
+	reader.read(num_textures);
+	if (reader.ok && num_textures <= file.size) {
+		cached.textures.resize(num_textures);
+		for (auto& texture : cached.textures) {
+			reader.read_string(texture.path);
+			reader.read_array(texture.data);
+		}
+	}
+
+	if (!reader.ok) {
+		LUMEN_WARN("Scene cache {} is corrupted, reloading the scene", cache_path);
+		return false;
+	}
+	scene = std::move(cached);
+	return true;
+}
+
+void SceneCache::save(const std::string& cache_path, const std::vector<std::string>& source_files,
+					  const LumenScene& scene) {
+	// Written to a temporary first so that readers never observe a partial cache
+	const std::string tmp_path = cache_path + ".tmp";
+	{
+		std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+		if (!out) {
+			LUMEN_WARN("Could not write scene cache {}", cache_path);
+			return;
+		}
+		CacheWriter writer{out};
+
+		SceneCacheHeader header;
+		memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(SCENE_CACHE_MAGIC));
+		header.version = SCENE_CACHE_VERSION;
+		header.build_flags = SCENE_CACHE_BUILD_FLAGS;
+		header.vec3_size = sizeof(glm::vec3);
+		header.prim_mesh_size = sizeof(LumenPrimMesh);
+		header.material_size = sizeof(Material);
+		header.light_size = sizeof(LumenLight);
+		header.num_sources = (uint32_t)source_files.size();
+		writer.write(header);
+
+		for (const auto& source : source_files) {
+			uint64_t size;
+			int64_t mtime;
+			if (!get_file_stamp(source, size, mtime)) {
+				out.close();
+				std::filesystem::remove(tmp_path);
+				return;
+			}
+			writer.write_string(source);
+			writer.write(size);
+			writer.write(mtime);
+		}
+
+		const auto& config = scene.config;
+		writer.write(config.integrator_type);
+		writer.write(config.path_length);
+		writer.write(config.sky_col);
+		writer.write(config.cam_settings);
+		writer.write(config.base_radius);
+		writer.write(config.radius_factor);
+		writer.write(config.mutations_per_pixel);
+		writer.write(config.num_bootstrap_samples);
+		writer.write(config.num_mlt_threads);
+		writer.write(config.enable_vm);
+		writer.write(config.light_first);
+		writer.write(config.alternate);
+		writer.write_string(config.integrator_name);
+		writer.write(scene.m_dimensions);
+
+		writer.write_array(scene.positions);
+		writer.write_array(scene.indices);
+		writer.write_array(scene.normals);
+		writer.write_array(scene.texcoords0);
+		writer.write_array(scene.materials);
+		writer.write_array(scene.lights);
+		writer.write_array(scene.mesh_instances);
+
+		writer.write((uint64_t)scene.prim_meshes.size());
+		for (const auto& pm : scene.prim_meshes) {
+			writer.write_string(pm.name);
+			writer.write(pm.material_idx);
+			writer.write(pm.vtx_offset);
+			writer.write(pm.first_idx);
+			writer.write(pm.idx_count);
+			writer.write(pm.vtx_count);
+			writer.write(pm.prim_idx);
+			writer.write(pm.min_pos);
+			writer.write(pm.max_pos);
+		}
+
+		writer.write((uint64_t)scene.textures.size());
+		for (const auto& texture : scene.textures) {
+			writer.write_string(texture.path);
+			writer.write_array(texture.data);
+		}
+		if (!out) {
+			LUMEN_WARN("Could not write scene cache {}", cache_path);
+			out.close();
+			std::filesystem::remove(tmp_path);
+			return;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmp_path, cache_path, ec);
+	if (ec) {
+		LUMEN_WARN("Could not write scene cache {}: {}", cache_path, ec.message());
+		std::filesystem::remove(tmp_path, ec);
+	}
+}
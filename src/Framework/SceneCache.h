@@ -0,0 +1,16 @@
+#pragma once
+#include "LumenPCH.h"
+#include "Framework/LumenScene.h"
+
+// Versioned binary snapshot of a loaded LumenScene, stored next to the scene
+// file. The cache records the size and modification time of every source file
+// it was built from, textures included, and is rejected as soon as any of them
+// changes.
+struct SceneCache {
+	static std::string get_path(const std::string& scene_path) { return scene_path + ".cache"; }
+	// Maps the cache and copies its arrays into the scene. Returns false on a
+	// miss, in which case the scene is left untouched
+	static bool load(const std::string& cache_path, LumenScene& scene);
+	static void save(const std::string& cache_path, const std::vector<std::string>& source_files,
+					 const LumenScene& scene);
+};
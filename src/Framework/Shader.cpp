@@ -3,6 +3,7 @@
 #include <spirv_cross/spirv_glsl.hpp>
 #include <spirv_cross/spirv.h>
 #include "RenderGraph.h"
+#include "ShaderBundle.h"
 #define USE_SHADERC 1
 
 enum class ResourceType { UniformBuffer, StorageBuffer, StorageImage, SampledImage, AccelarationStructure };
@@ -449,15 +450,13 @@ static void parse_shader(Shader& shader, const uint32_t* code, size_t code_size,
 		uint32_t pc_size = get_pc_size(glsl, type);
 		shader.push_constant_size = pc_size;
 	}
-	if (pass->rg->settings.shader_inference) {
+	if (pass && pass->rg->settings.shader_inference) {
 		parse_spirv(glsl, resources, shader, code, code_size, pass);
 	}
 }
 
 #if USE_SHADERC
 #include <shaderc/shaderc.hpp>
-#include <libshaderc_util/file_finder.h>
-#include <glslc/file_includer.h>
 
 static std::unordered_map<std::string, shaderc_shader_kind> mstages = {
 	{"vert", shaderc_vertex_shader}, {"frag", shaderc_fragment_shader}, {"comp", shaderc_compute_shader},
@@ -465,19 +464,129 @@ static std::unordered_map<std::string, shaderc_shader_kind> mstages = {
 	{"rmiss", shaderc_miss_shader},
 };
 
-std::string preprocess_shader(const std::string& source_name, shaderc_shader_kind kind, const std::string& source) {
+// Included files are read once and shared by every compiling thread. Entries
+// are revalidated against the write time so that hot reload picks up edits
+struct IncludeFile {
+	std::string path;
+	std::string contents;
+	std::filesystem::file_time_type write_time;
+};
+
+static std::mutex include_cache_mutex;
+static std::unordered_map<std::string, std::shared_ptr<const IncludeFile>> include_cache;
+
+static std::shared_ptr<const IncludeFile> read_include(const std::string& path) {
+	std::error_code ec;
+	auto write_time = std::filesystem::last_write_time(path, ec);
+	if (ec) {
+		return nullptr;
+	}
+	{
+		std::lock_guard<std::mutex> lock(include_cache_mutex);
+		auto it = include_cache.find(path);
+		if (it != include_cache.end() && it->second->write_time == write_time) {
+			return it->second;
+		}
+	}
+	std::ifstream fin(path, std::ios::binary);
+	if (!fin) {
+		return nullptr;
+	}
+	std::stringstream buffer;
+	buffer << fin.rdbuf();
+	auto file = std::make_shared<IncludeFile>(IncludeFile{path, buffer.str(), write_time});
+	std::lock_guard<std::mutex> lock(include_cache_mutex);
+	include_cache[path] = file;
+	return file;
+}
+
+// Resolves includes like glslc's FileIncluder: "relative" includes against the
+// including file first, then everything against the working directory
+static std::shared_ptr<const IncludeFile> resolve_include(const std::string& requested_source,
+														  const std::string& requesting_source, bool relative) {
+	std::shared_ptr<const IncludeFile> file;
+	if (relative) {
+		auto path = std::filesystem::path(requesting_source).parent_path() / requested_source;
+		file = read_include(path.lexically_normal().generic_string());
+	}
+	if (!file) {
+		file = read_include(std::filesystem::path(requested_source).lexically_normal().generic_string());
+	}
+	return file;
+}
+
+// Serves includes from the include cache
+class CachedIncluder : public shaderc::CompileOptions::IncluderInterface {
+   public:
+	shaderc_include_result* GetInclude(const char* requested_source, shaderc_include_type type,
+									   const char* requesting_source, size_t include_depth) override {
+		std::shared_ptr<const IncludeFile> file =
+			resolve_include(requested_source, requesting_source, type == shaderc_include_type_relative);
+		auto result = new shaderc_include_result{};
+		if (!file) {
+			auto error = new std::string("Cannot find or open include file: " + std::string(requested_source));
+			result->content = error->c_str();
+			result->content_length = error->size();
+			result->user_data = error;
+			return result;
+		}
+		included_files.insert(file->path);
+		result->source_name = file->path.c_str();
+		result->source_name_length = file->path.size();
+		result->content = file->contents.c_str();
+		result->content_length = file->contents.size();
+		// Keeps the cache entry alive until the result is released
+		result->user_data = new std::shared_ptr<const IncludeFile>(std::move(file));
+		return result;
+	}
+
+	void ReleaseInclude(shaderc_include_result* result) override {
+		if (result->source_name_length) {
+			delete (std::shared_ptr<const IncludeFile>*)result->user_data;
+		} else {
+			delete (std::string*)result->user_data;
+		}
+		delete result;
+	}
+
+	std::unordered_set<std::string> included_files;
+};
+
+// Options shared by all compilations. The SPIR-V cache key is derived from the
+// same values, see get_compile_options_string
+static constexpr shaderc_spirv_version SPIRV_TARGET_VERSION = shaderc_spirv_version_1_6;
+static constexpr uint32_t VULKAN_TARGET_ENV_VERSION = 2;
+// Like -DMY_DEFINE=1
+static const ShaderDefines GLOBAL_SHADER_DEFINES = {{"MY_DEFINE", "1"}};
+// Shader::compile builds unoptimized SPIR-V
+static constexpr bool OPTIMIZE_SHADERS = false;
+
+// Creating a compiler is not free, every thread keeps its own together with
+// the options shared by all compilations
+struct ShaderCompilerContext {
 	shaderc::Compiler compiler;
 	shaderc::CompileOptions options;
-	shaderc_util::FileFinder fileFinder;
-	options.SetIncluder(std::make_unique<glslc::FileIncluder>(&fileFinder));
-	options.SetTargetSpirv(shaderc_spirv_version_1_6);
-	options.SetTargetEnvironment(shaderc_target_env_vulkan, 2);
+	ShaderCompilerContext() {
+		for (const auto& [name, value] : GLOBAL_SHADER_DEFINES) {
+			options.AddMacroDefinition(name, value);
+		}
+		options.SetTargetSpirv(SPIRV_TARGET_VERSION);
+		options.SetTargetEnvironment(shaderc_target_env_vulkan, VULKAN_TARGET_ENV_VERSION);
+	}
+};
 
-	// Like -DMY_DEFINE=1
-	options.AddMacroDefinition("MY_DEFINE", "1");
+static ShaderCompilerContext& get_compiler_context() {
+	thread_local ShaderCompilerContext context;
+	return context;
+}
+
+std::string preprocess_shader(const std::string& source_name, shaderc_shader_kind kind, const std::string& source) {
+	auto& context = get_compiler_context();
+	shaderc::CompileOptions options(context.options);
+	options.SetIncluder(std::make_unique<CachedIncluder>());
 
 	shaderc::PreprocessedSourceCompilationResult result =
-		compiler.PreprocessGlsl(source, kind, source_name.c_str(), options);
+		context.compiler.PreprocessGlsl(source, kind, source_name.c_str(), options);
 
 	if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
 		std::cerr << result.GetErrorMessage();
@@ -489,20 +598,13 @@ std::string preprocess_shader(const std::string& source_name, shaderc_shader_kin
 
 std::string compile_file_to_assembly(const std::string& source_name, shaderc_shader_kind kind,
 									 const std::string& source, bool optimize = false) {
-	shaderc::Compiler compiler;
-	shaderc::CompileOptions options;
-
-	// Like -DMY_DEFINE=1
-	options.AddMacroDefinition("MY_DEFINE", "1");
+	auto& context = get_compiler_context();
+	shaderc::CompileOptions options(context.options);
 	if (optimize) options.SetOptimizationLevel(shaderc_optimization_level_size);
-
-	shaderc_util::FileFinder fileFinder;
-	options.SetIncluder(std::make_unique<glslc::FileIncluder>(&fileFinder));
-	options.SetTargetSpirv(shaderc_spirv_version_1_6);
-	options.SetTargetEnvironment(shaderc_target_env_vulkan, 2);
+	options.SetIncluder(std::make_unique<CachedIncluder>());
 
 	shaderc::AssemblyCompilationResult result =
-		compiler.CompileGlslToSpvAssembly(source, kind, source_name.c_str(), options);
+		context.compiler.CompileGlslToSpvAssembly(source, kind, source_name.c_str(), options);
 
 	if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
 		std::cerr << result.GetErrorMessage();
@@ -513,66 +615,262 @@ std::string compile_file_to_assembly(const std::string& source_name, shaderc_sha
 }
 
 std::vector<uint32_t> compile_file(const std::string& source_name, shaderc_shader_kind kind, const std::string& source,
-								   bool optimize = false) {
-	shaderc::Compiler compiler;
-	shaderc::CompileOptions options;
-
-	// Like -DMY_DEFINE=1
-	options.AddMacroDefinition("MY_DEFINE", "1");
+								   const ShaderDefines& defines = {}, bool optimize = false,
+								   std::vector<std::string>* includes = nullptr) {
+	auto& context = get_compiler_context();
+	shaderc::CompileOptions options(context.options);
 	if (optimize) options.SetOptimizationLevel(shaderc_optimization_level_size);
+	for (const auto& [name, value] : defines) {
+		options.AddMacroDefinition(name, value);
+	}
 
-	shaderc_util::FileFinder fileFinder;
-	options.SetIncluder(std::make_unique<glslc::FileIncluder>(&fileFinder));
-	options.SetTargetSpirv(shaderc_spirv_version_1_6);
-	options.SetTargetEnvironment(shaderc_target_env_vulkan, 2);
+	auto includer = std::make_unique<CachedIncluder>();
+	// Owned by the options, which outlive the compilation below
+	const CachedIncluder* cached_includer = includer.get();
+	options.SetIncluder(std::move(includer));
 #if 0
 	options.SetGenerateDebugInfo();
 #endif
 
-	shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(source, kind, source_name.c_str(), options);
+	shaderc::SpvCompilationResult module =
+		context.compiler.CompileGlslToSpv(source, kind, source_name.c_str(), options);
 
 	if (module.GetCompilationStatus() != shaderc_compilation_status_success) {
 		std::cerr << module.GetErrorMessage();
 		return std::vector<uint32_t>();
 	}
 
+	if (includes) {
+		includes->assign(cached_includer->included_files.begin(), cached_includer->included_files.end());
+	}
 	return {module.cbegin(), module.cend()};
 }
-#endif
 
-Shader::Shader() {}
-Shader::Shader(const std::string& filename) : filename(filename) {}
-int Shader::compile(RenderPass* pass) {
-	LUMEN_TRACE("Compiling shader: {0}", filename);
-#if USE_SHADERC
+// Compiled SPIR-V is cached on disk, keyed by the hash of the shader source,
+// every file it transitively includes and the compile options above. Bump the
+// version when the compiler changes in a way the options string can't capture
+static constexpr uint32_t SPIRV_CACHE_VERSION = 1;
+static constexpr uint32_t SPIRV_CACHE_MAGIC = 0x5650534C;  // "LSPV"
+static const std::string SPIRV_CACHE_DIR = "shader_cache/";
+
+static std::string get_defines_string(const ShaderDefines& defines) {
+	std::string str;
+	for (const auto& [name, value] : defines) {
+		str += "|" + name + "=" + value;
+	}
+	return str;
+}
+
+static std::string get_compile_options_string(bool optimize) {
+	unsigned int spv_version = 0, spv_revision = 0;
+	shaderc_get_spv_version(&spv_version, &spv_revision);
+	std::stringstream options;
+	options << "spv" << std::hex << SPIRV_TARGET_VERSION << ";vulkan" << VULKAN_TARGET_ENV_VERSION
+			<< get_defines_string(GLOBAL_SHADER_DEFINES) << ";O" << (optimize ? "s" : "0") << ";shaderc"
+			<< spv_version << "." << spv_revision << ";";
+	return options.str();
+}
+
+// Appends the contents of every file included by the given source, recursively.
+// Returns false if an include can't be read, the compiler will report it
+static bool gather_includes(const std::string& source_name, const std::string& source, std::string& out,
+							robin_hood::unordered_flat_set<std::string>& visited) {
+	std::istringstream lines(source);
+	std::string line;
+	while (std::getline(lines, line)) {
+		auto pos = line.find_first_not_of(" \t");
+		if (pos == std::string::npos || line.compare(pos, 8, "#include") != 0) {
+			continue;
+		}
+		auto begin = line.find_first_of("\"<", pos + 8);
+		auto end = begin == std::string::npos ? begin : line.find_first_of("\">", begin + 1);
+		if (end == std::string::npos) {
+			continue;
+		}
+		auto include_file =
+			resolve_include(line.substr(begin + 1, end - begin - 1), source_name, line[begin] == '"');
+		if (!include_file) {
+			return false;
+		}
+		if (!visited.insert(include_file->path).second) {
+			continue;
+		}
+		out += include_file->path;
+		out += include_file->contents;
+		if (!gather_includes(include_file->path, include_file->contents, out, visited)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool get_spirv_cache_key(const std::string& filename, const ShaderDefines& defines, const std::string& source,
+								bool optimize, uint64_t& key, std::vector<std::string>& includes) {
+	std::string contents = get_compile_options_string(optimize) + get_defines_string(defines) + source;
+	robin_hood::unordered_flat_set<std::string> visited;
+	const std::string self = std::filesystem::path(filename).lexically_normal().generic_string();
+	visited.insert(self);
+	if (!gather_includes(filename, source, contents, visited)) {
+		return false;
+	}
+	includes.clear();
+	for (const auto& include : visited) {
+		if (include != self) {
+			includes.push_back(include);
+		}
+	}
+	key = robin_hood::hash_bytes(contents.data(), contents.size());
+	return true;
+}
+
+// Every variant of a shader gets its own file so that switching scenes
+// doesn't evict the permutations of the previous one
+static std::string get_spirv_cache_path(const std::string& filename, const ShaderDefines& defines) {
+	std::string name = filename;
+	std::replace_if(
+		name.begin(), name.end(), [](char c) { return c == '/' || c == '\\' || c == ':' || c == '.'; }, '_');
+	if (!defines.empty()) {
+		const std::string defines_str = get_defines_string(defines);
+		std::stringstream suffix;
+		suffix << "_" << std::hex << robin_hood::hash_bytes(defines_str.data(), defines_str.size());
+		name += suffix.str();
+	}
+	return SPIRV_CACHE_DIR + name + ".spv";
+}
+
+static bool load_cached_spirv(const std::string& filename, const ShaderDefines& defines, uint64_t key,
+							  std::vector<uint32_t>& binary) {
+	std::ifstream fin(get_spirv_cache_path(filename, defines), std::ios::binary | std::ios::ate);
+	if (!fin) {
+		return false;
+	}
+	const size_t file_size = (size_t)fin.tellg();
+	uint32_t header[4];
+	if (file_size <= sizeof(header) || (file_size - sizeof(header)) % sizeof(uint32_t)) {
+		return false;
+	}
+	fin.seekg(0);
+	fin.read((char*)header, sizeof(header));
+	if (header[0] != SPIRV_CACHE_MAGIC || header[1] != SPIRV_CACHE_VERSION ||
+		memcmp(&header[2], &key, sizeof(key)) != 0) {
+		return false;
+	}
+	binary.resize((file_size - sizeof(header)) / sizeof(uint32_t));
+	fin.read((char*)binary.data(), binary.size() * sizeof(uint32_t));
+	if (!fin || binary[0] != SpvMagicNumber) {
+		binary.clear();
+		return false;
+	}
+	return true;
+}
+
+static void store_cached_spirv(const std::string& filename, const ShaderDefines& defines, uint64_t key,
+							   const std::vector<uint32_t>& binary) {
+	std::error_code ec;
+	std::filesystem::create_directories(SPIRV_CACHE_DIR, ec);
+	const std::string cache_path = get_spirv_cache_path(filename, defines);
+	// Shaders are compiled from several threads, keep temporaries apart
+	std::stringstream tmp_path;
+	tmp_path << cache_path << "." << std::this_thread::get_id() << ".tmp";
+	{
+		std::ofstream fout(tmp_path.str(), std::ios::binary | std::ios::trunc);
+		uint32_t header[4] = {SPIRV_CACHE_MAGIC, SPIRV_CACHE_VERSION};
+		memcpy(&header[2], &key, sizeof(key));
+		fout.write((const char*)header, sizeof(header));
+		fout.write((const char*)binary.data(), binary.size() * sizeof(uint32_t));
+		if (!fout) {
+			LUMEN_WARN("Could not write SPIR-V cache for {}", filename);
+			fout.close();
+			std::filesystem::remove(tmp_path.str(), ec);
+			return;
+		}
+	}
+	std::filesystem::rename(tmp_path.str(), cache_path, ec);
+	if (ec) {
+		std::filesystem::remove(tmp_path.str(), ec);
+	}
+}
+
+// Returns false if the file can't be opened, e.g. on machines that only ship the shader bundle
+static bool read_shader_source(const std::string& filename, std::string& source) {
 	std::ifstream fin(filename);
+	if (!fin) {
+		return false;
+	}
 	std::stringstream buffer;
 	buffer << fin.rdbuf();
+	buffer << "\n";
+	source = buffer.str();
+	return true;
+}
+#endif
+
+Shader::Shader() {}
+Shader::Shader(const std::string& filename, const ShaderDefines& defines) : filename(filename), defines(defines) {}
+
+std::string Shader::get_variant_key() const {
+	std::string key = filename;
+	for (const auto& [name, value] : defines) {
+		key += "|" + name + "=" + value;
+	}
+	return key;
+}
+
+int Shader::compile(RenderPass* pass, bool use_bundle) {
+	const Shader* bundled = use_bundle ? ShaderBundle::find(filename, defines) : nullptr;
+	if (bundled) {
+		const std::string name = filename;
+		*this = *bundled;
+		filename = name;
+		if (pass) {
+			infer_resources(pass);
+		}
+		return 0;
+	}
+#if USE_SHADERC
 	auto get_ext = [](const std::string& str) -> std::string {
 		auto fnd = str.rfind('.');
 		assert(fnd != std::string::npos);
 		return str.substr(fnd + 1);
 	};
-	buffer << "\n";
-	auto get_path = [](const std::string& str) -> std::string {
-		auto fnd = str.rfind('/');
-		assert(fnd != std::string::npos);
-		return str.substr(0, fnd);
-	};
-	const auto& str = buffer.str();
-	 // Compiling
-	binary = compile_file(filename, mstages[get_ext(filename)], str);
+	std::string str;
+	if (!read_shader_source(filename, str)) {
+		LUMEN_CRITICAL("Could not open shader source {}", filename);
+		return -1;
+	}
+	uint64_t cache_key;
+	// On a cache hit the includes come from scanning the sources, otherwise
+	// they are taken from the files the shaderc includer actually opened
+	const bool cacheable = get_spirv_cache_key(filename, defines, str, OPTIMIZE_SHADERS, cache_key, includes);
+	source_hash = cacheable ? cache_key : 0;
+	if (cacheable && load_cached_spirv(filename, defines, cache_key, binary)) {
+		LUMEN_TRACE("Loaded cached shader: {0}", filename);
+	} else {
+		LUMEN_TRACE("Compiling shader: {0}", filename);
+		binary = compile_file(filename, mstages[get_ext(filename)], str, defines, OPTIMIZE_SHADERS, &includes);
+		if (binary.empty()) {
+			return -1;
+		}
+		if (cacheable) {
+			store_cached_spirv(filename, defines, cache_key, binary);
+		}
+	}
 	parse_shader(*this, binary.data(), binary.size(), pass);
 	return 0;
 #else
+	LUMEN_TRACE("Compiling shader: {0}", filename);
 	std::string file_path = filename + ".spv";
+	std::string define_args;
+	for (const auto& [name, value] : defines) {
+		define_args += " -D" + name + "=" + value;
+	}
 #ifdef _DEBUG
-	auto str = std::string("glslangValidator.exe --target-env vulkan1.3 " + filename + " -V " + " -g " + " -o " +
-						   filename + ".spv");
+	auto str = std::string("glslangValidator.exe --target-env vulkan1.3 " + filename + define_args + " -V " + " -g " +
+						   " -o " + filename + ".spv");
 
 #else
-	auto str =
-		std::string("glslangValidator.exe --target-env vulkan1.3 " + filename + " -V " + " -o " + filename + ".spv");
+	auto str = std::string("glslangValidator.exe --target-env vulkan1.3 " + filename + define_args + " -V " + " -o " +
+						   filename + ".spv");
 #endif	//  NDEBUG
 
 	binary.clear();
@@ -595,6 +893,26 @@ int Shader::compile(RenderPass* pass) {
 #endif
 }
 
+bool Shader::get_source_hash(uint64_t& hash) const {
+#if USE_SHADERC
+	std::string source;
+	std::vector<std::string> source_includes;
+	return read_shader_source(filename, source) &&
+		   get_spirv_cache_key(filename, defines, source, OPTIMIZE_SHADERS, hash, source_includes);
+#else
+	return false;
+#endif
+}
+
+void Shader::infer_resources(RenderPass* pass) {
+	if (binary.empty() || !pass->rg->settings.shader_inference) {
+		return;
+	}
+	spirv_cross::CompilerGLSL glsl(binary.data(), binary.size());
+	spirv_cross::ShaderResources resources = glsl.get_shader_resources();
+	parse_spirv(glsl, resources, *this, binary.data(), binary.size(), pass);
+}
+
 VkShaderModule Shader::create_vk_shader_module(const VkDevice& device) const {
 	VkShaderModuleCreateInfo shader_module_CI{};
 	shader_module_CI.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -2,12 +2,17 @@
 #include "LumenPCH.h"
 #include "CommonTypes.h"
 #include "Buffer.h"
+#include <map>
 
 class RenderPass;
 
+// Macro name -> value, sorted so that equal sets produce the same shader variant
+using ShaderDefines = std::map<std::string, std::string>;
+
 struct Shader {
 	std::vector<uint32_t> binary;
 	std::string filename;
+	ShaderDefines defines;
 
 	VkShaderStageFlagBits stage = VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM;
 	VkDescriptorType descriptor_types[32] = {};
@@ -19,9 +24,21 @@ struct Shader {
 	bool uses_push_constants = false;
 	uint32_t push_constant_size = 0;
 	Shader();
-	Shader(const std::string& filename);
-	int compile(RenderPass* pass);
+	Shader(const std::string& filename, const ShaderDefines& defines = {});
+	// Identifies the compiled permutation: the filename followed by the defines
+	std::string get_variant_key() const;
+	// Resource inference is skipped when no pass is given. The loaded shader
+	// bundle is consulted first unless use_bundle is false
+	int compile(RenderPass* pass, bool use_bundle = true);
+	void infer_resources(RenderPass* pass);
 	VkShaderModule create_vk_shader_module(const VkDevice& device) const;
 	std::vector<std::pair<VkFormat, uint32_t>> vertex_inputs;
 	std::unordered_map<Buffer*, BufferStatus> buffer_status_map;
+	// Every file transitively included by the shader source
+	std::vector<std::string> includes;
+	// Hash of the sources, defines and compile options the binary was built
+	// from (the SPIR-V cache key), 0 if unknown
+	uint64_t source_hash = 0;
+	// Computes the hash above from the current files. Returns false if a file can't be read
+	bool get_source_hash(uint64_t& hash) const;
 };
@@ -0,0 +1,280 @@
+#include "LumenPCH.h"
+#include "ShaderBundle.h"
+
+// Bump whenever the layout below or the reflected Shader fields change
+static constexpr uint32_t SHADER_BUNDLE_VERSION = 3;
+static constexpr char SHADER_BUNDLE_MAGIC[4] = {'L', 'S', 'B', 'N'};
+// Same stages Shader::compile knows how to compile
+static const char* SHADER_STAGE_EXTENSIONS[] = {".vert", ".frag", ".comp", ".rgen", ".rahit", ".rchit", ".rmiss"};
+
+// Written once before any pass is built, read-only afterwards
+static std::unordered_map<std::string, Shader> bundled_shaders;
+
+static std::string get_bundle_path(const std::string& filename) {
+	return std::filesystem::path(filename).lexically_normal().generic_string();
+}
+
+static std::string get_bundle_key(const std::string& filename, const ShaderDefines& defines) {
+	return Shader(get_bundle_path(filename), defines).get_variant_key();
+}
+
+struct BundleWriter {
+	std::ofstream& out;
+
+	template <typename T>
+	void write(const T& val) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		out.write((const char*)&val, sizeof(T));
+	}
+
+	template <typename T>
+	void write_array(const std::vector<T>& arr) {
+		write((uint64_t)arr.size());
+		out.write((const char*)arr.data(), arr.size() * sizeof(T));
+	}
+
+	void write_string(const std::string& str) {
+		write((uint32_t)str.size());
+		out.write(str.data(), str.size());
+	}
+};
+
+struct BundleReader {
+	const char* ptr;
+	const char* end;
+	bool ok = true;
+
+	bool read_bytes(void* dst, size_t size) {
+		if (!ok || size_t(end - ptr) < size) {
+			ok = false;
+			return false;
+		}
+		memcpy(dst, ptr, size);
+		ptr += size;
+		return true;
+	}
+
+	template <typename T>
+	bool read(T& val) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		return read_bytes(&val, sizeof(T));
+	}
+
+	template <typename T>
+	bool read_array(std::vector<T>& arr) {
+		uint64_t count = 0;
+		if (!read(count) || count > size_t(end - ptr) / sizeof(T)) {
+			ok = false;
+			return false;
+		}
+		arr.resize(count);
+		return read_bytes(arr.data(), count * sizeof(T));
+	}
+
+	bool read_string(std::string& str) {
+		uint32_t len = 0;
+		if (!read(len) || len > size_t(end - ptr)) {
+			ok = false;
+			return false;
+		}
+		str.assign(ptr, len);
+		ptr += len;
+		return true;
+	}
+};
+
+bool ShaderBundle::build(const std::string& shader_dir, const std::string& bundle_path,
+						 const std::vector<ShaderDefines>& variants) {
+	std::vector<std::string> filenames;
+	std::error_code ec;
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(shader_dir, ec)) {
+		const auto ext = entry.path().extension().string();
+		if (entry.is_regular_file() && std::find(std::begin(SHADER_STAGE_EXTENSIONS), std::end(SHADER_STAGE_EXTENSIONS),
+												 ext) != std::end(SHADER_STAGE_EXTENSIONS)) {
+			filenames.push_back(get_bundle_path(entry.path().string()));
+		}
+	}
+	if (ec || filenames.empty()) {
+		LUMEN_CRITICAL("No shaders found in {}", shader_dir);
+		return false;
+	}
+	// Sorted so that the same sources always produce the same bundle
+	std::sort(filenames.begin(), filenames.end());
+
+	std::vector<std::future<Shader>> tasks;
+	tasks.reserve(filenames.size() * variants.size());
+	for (const auto& filename : filenames) {
+		for (const auto& defines : variants) {
+			tasks.push_back(ThreadPool::submit(
+				[](const std::string& filename, const ShaderDefines& defines) {
+					Shader shader(filename, defines);
+					shader.compile(nullptr, false);
+					return shader;
+				},
+				filename, defines));
+		}
+	}
+
+	// A shader that fails to compile is left out, Shader::compile falls back to
+	// compiling it from source at runtime
+	std::vector<Shader> shaders;
+	shaders.reserve(tasks.size());
+	for (size_t i = 0; i < tasks.size(); i++) {
+		Shader shader;
+		try {
+			shader = tasks[i].get();
+		} catch (const std::exception& e) {
+			LUMEN_CRITICAL("{}", e.what());
+		}
+		if (shader.binary.empty() || !shader.source_hash) {
+			const auto& filename = filenames[i / variants.size()];
+			LUMEN_CRITICAL("Failed to compile {}, leaving it out of the bundle",
+						   Shader(filename, variants[i % variants.size()]).get_variant_key());
+			continue;
+		}
+		shaders.push_back(std::move(shader));
+	}
+	if (shaders.empty()) {
+		LUMEN_CRITICAL("Failed to build shader bundle {}", bundle_path);
+		return false;
+	}
+
+	const std::string tmp_path = bundle_path + ".tmp";
+	bool success = true;
+	{
+		std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+		if (!out) {
+			LUMEN_CRITICAL("Could not write shader bundle {}", bundle_path);
+			return false;
+		}
+		BundleWriter writer{out};
+		out.write(SHADER_BUNDLE_MAGIC, sizeof(SHADER_BUNDLE_MAGIC));
+		writer.write(SHADER_BUNDLE_VERSION);
+		writer.write((uint32_t)shaders.size());
+		for (const auto& shader : shaders) {
+			writer.write_string(shader.filename);
+			writer.write((uint32_t)shader.defines.size());
+			for (const auto& [name, value] : shader.defines) {
+				writer.write_string(name);
+				writer.write_string(value);
+			}
+			writer.write(shader.source_hash);
+			writer.write(shader.stage);
+			writer.write(shader.descriptor_types);
+			writer.write(shader.binding_mask);
+			writer.write(shader.local_size_x);
+			writer.write(shader.local_size_y);
+			writer.write(shader.local_size_z);
+			writer.write(shader.uses_push_constants);
+			writer.write(shader.push_constant_size);
+			writer.write((uint32_t)shader.vertex_inputs.size());
+			for (const auto& [format, size] : shader.vertex_inputs) {
+				writer.write(format);
+				writer.write(size);
+			}
+			writer.write((uint32_t)shader.includes.size());
+			for (const auto& include : shader.includes) {
+				writer.write_string(include);
+			}
+			writer.write_array(shader.binary);
+			LUMEN_TRACE("Bundled shader: {}", shader.get_variant_key());
+		}
+		success = !!out;
+	}
+	if (!success) {
+		LUMEN_CRITICAL("Failed to build shader bundle {}", bundle_path);
+		std::filesystem::remove(tmp_path, ec);
+		return false;
+	}
+	std::filesystem::rename(tmp_path, bundle_path, ec);
+	if (ec) {
+		LUMEN_CRITICAL("Could not write shader bundle {}: {}", bundle_path, ec.message());
+		std::filesystem::remove(tmp_path, ec);
+		return false;
+	}
+	LUMEN_TRACE("Wrote {} of {} shader variants to {}", shaders.size(), tasks.size(), bundle_path);
+	return true;
+}
+
+bool ShaderBundle::load(const std::string& bundle_path) {
+	std::ifstream fin(bundle_path, std::ios::binary | std::ios::ate);
+	if (!fin) {
+		LUMEN_WARN("Could not open shader bundle {}", bundle_path);
+		return false;
+	}
+	std::vector<char> data((size_t)fin.tellg());
+	fin.seekg(0);
+	fin.read(data.data(), data.size());
+	BundleReader reader{data.data(), data.data() + data.size()};
+
+	char magic[4];
+	uint32_t version = 0;
+	uint32_t num_shaders = 0;
+	if (!reader.read(magic) || memcmp(magic, SHADER_BUNDLE_MAGIC, sizeof(magic)) != 0 || !reader.read(version) ||
+		version != SHADER_BUNDLE_VERSION || !reader.read(num_shaders)) {
+		LUMEN_WARN("Shader bundle {} is outdated, compiling shaders from source", bundle_path);
+		return false;
+	}
+	std::unordered_map<std::string, Shader> shaders;
+	for (uint32_t i = 0; i < num_shaders && reader.ok; i++) {
+		Shader shader;
+		reader.read_string(shader.filename);
+		uint32_t num_defines = 0;
+		reader.read(num_defines);
+		for (uint32_t j = 0; j < num_defines && reader.ok; j++) {
+			std::string name, value;
+			reader.read_string(name);
+			reader.read_string(value);
+			shader.defines[name] = value;
+		}
+		reader.read(shader.source_hash);
+		reader.read(shader.stage);
+		reader.read(shader.descriptor_types);
+		reader.read(shader.binding_mask);
+		reader.read(shader.local_size_x);
+		reader.read(shader.local_size_y);
+		reader.read(shader.local_size_z);
+		reader.read(shader.uses_push_constants);
+		reader.read(shader.push_constant_size);
+		uint32_t num_vertex_inputs = 0;
+		reader.read(num_vertex_inputs);
+		for (uint32_t j = 0; j < num_vertex_inputs && reader.ok; j++) {
+			auto& [format, size] = shader.vertex_inputs.emplace_back();
+			reader.read(format);
+			reader.read(size);
+		}
+		uint32_t num_includes = 0;
+		reader.read(num_includes);
+		for (uint32_t j = 0; j < num_includes && reader.ok; j++) {
+			reader.read_string(shader.includes.emplace_back());
+		}
+		reader.read_array(shader.binary);
+		shaders[shader.get_variant_key()] = std::move(shader);
+	}
+	if (!reader.ok) {
+		LUMEN_WARN("Shader bundle {} is corrupted, compiling shaders from source", bundle_path);
+		return false;
+	}
+	// Entries whose sources were edited since the bundle was built are compiled from source instead.
+	// Entries without readable sources are kept, render nodes ship the bundle alone
+	for (auto it = shaders.begin(); it != shaders.end();) {
+		uint64_t source_hash;
+		if (it->second.get_source_hash(source_hash) && source_hash != it->second.source_hash) {
+			LUMEN_WARN("Bundled shader {} is stale, compiling it from source", it->first);
+			it = shaders.erase(it);
+		} else {
+			++it;
+		}
+	}
+	bundled_shaders = std::move(shaders);
+	LUMEN_TRACE("Loaded {} shaders from {}", bundled_shaders.size(), bundle_path);
+	return true;
+}
+
+const Shader* ShaderBundle::find(const std::string& filename, const ShaderDefines& defines) {
+	if (bundled_shaders.empty()) {
+		return nullptr;
+	}
+	auto it = bundled_shaders.find(get_bundle_key(filename, defines));
+	return it == bundled_shaders.end() ? nullptr : &it->second;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "LumenPCH.h"
+#include "Framework/Shader.h"
+
+// Precompiled shaders for machines that shouldn't compile GLSL at startup.
+// A bundle holds the SPIR-V of every shader stage together with the reflection
+// data parse_shader derives from it, so that Shader::compile only has to run
+// the per-pass resource inference on a hit. Entries carry the hash of their
+// sources and are skipped once those change, entries whose sources are
+// missing are used as is
+struct ShaderBundle {
+	static constexpr const char* DEFAULT_PATH = "shaders.bundle";
+	// Compiles every shader stage under the directory once per define set in
+	// parallel and writes the bundle. Stages that fail to compile are left out
+	static bool build(const std::string& shader_dir, const std::string& bundle_path,
+					  const std::vector<ShaderDefines>& variants);
+	static bool load(const std::string& bundle_path);
+	// Returns nullptr if no bundle is loaded or the variant isn't part of it
+	static const Shader* find(const std::string& filename, const ShaderDefines& defines);
+};
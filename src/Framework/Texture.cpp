@@ -1,6 +1,7 @@
 #include "LumenPCH.h"
 #include "Texture.h"
 #include "Framework/CommandBuffer.h"
+#include "Framework/UploadBatch.h"
 #include "Framework/VkUtils.h"
 #include <gli/gli.hpp>
 #include <stb_image.h>
@@ -88,13 +89,19 @@ VkDescriptorImageInfo Texture2D::descriptor() const {
 
 void Texture2D::load_from_data(VulkanContext* ctx, void* data, VkDeviceSize size, const VkImageCreateInfo& info,
 							   VkSampler a_sampler, bool generate_mipmaps) {
+	// Mipmaps are blitted, which the transfer queue can't do
+	UploadBatch batch(ctx, generate_mipmaps);
+	load_from_data(batch, ctx, data, size, info, a_sampler, generate_mipmaps);
+	batch.submit();
+}
+
+void Texture2D::load_from_data(UploadBatch& batch, VulkanContext* ctx, const void* data, VkDeviceSize size,
+							   const VkImageCreateInfo& info, VkSampler a_sampler, bool generate_mipmaps) {
+	LUMEN_ASSERT(!generate_mipmaps || batch.supports_graphics(), "Mipmaps need a graphics upload batch");
 	this->ctx = ctx;
 	aspect_flags = VK_IMAGE_ASPECT_COLOR_BIT;
 	usage_flags = VK_IMAGE_USAGE_SAMPLED_BIT;
-	Buffer staging_buffer;
-	staging_buffer.create(ctx, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-						  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-						  VK_SHARING_MODE_EXCLUSIVE, size, data);
+	const UploadBatch::StagingRange staging = batch.stage(data, size);
 
 	// Need to do this check pre image creation
 	if (generate_mipmaps) {
@@ -113,7 +120,7 @@ void Texture2D::load_from_data(VulkanContext* ctx, void* data, VkDeviceSize size
 
 	VkBufferImageCopy region{};
 
-	region.bufferOffset = 0;
+	region.bufferOffset = staging.offset;
 	region.bufferRowLength = 0;
 	region.bufferImageHeight = 0;
 	region.imageSubresource.aspectMask = aspect_flags;
@@ -123,21 +130,16 @@ void Texture2D::load_from_data(VulkanContext* ctx, void* data, VkDeviceSize size
 	region.imageExtent.width = info.extent.width;
 	region.imageExtent.height = info.extent.height;
 	region.imageExtent.depth = 1;
-	CommandBuffer copy_cmd(ctx, true);
-	transition_image_layout(copy_cmd.handle, img, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	transition_image_layout(batch.cmd(), img, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 							subresource_range, aspect_flags);
 
-	vkCmdCopyBufferToImage(copy_cmd.handle, staging_buffer.handle, img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
-						   &region);
+	vkCmdCopyBufferToImage(batch.cmd(), staging.buffer, img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
 	if (generate_mipmaps) {
-		cmd_generate_mipmaps(info, copy_cmd.handle);
+		cmd_generate_mipmaps(info, batch.cmd());
 	} else {
-		transition_image_layout(copy_cmd.handle, img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-								VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresource_range, aspect_flags);
+		batch.finish_image(img, subresource_range);
 	}
-	copy_cmd.submit();
-	staging_buffer.destroy();
 	img_view = create_image_view(ctx->device, img, info.format);
 	this->sampler = a_sampler;
 
@@ -209,15 +211,9 @@ Texture::Texture(VulkanContext* ctx) : ctx(ctx) {}
 void Texture::create_image(const VkImageCreateInfo& info) {
 	vk::check(vkCreateImage(ctx->device, &info, nullptr, &img), "Failed to create image");
 
-	VkMemoryRequirements mem_req;
-	vkGetImageMemoryRequirements(ctx->device, img, &mem_req);
-	auto alloc_info = vk::memory_allocate_info();
-	alloc_info.allocationSize = mem_req.size;
-	alloc_info.memoryTypeIndex =
-		find_memory_type(&ctx->physical_device, mem_req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-	vk::check(vkAllocateMemory(ctx->device, &alloc_info, nullptr, &img_mem), "Failed to allocate image memory");
-	vkBindImageMemory(ctx->device, img, img_mem, 0);
+	allocation = ctx->allocator->allocate_image(img, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	vk::check(vkBindImageMemory(ctx->device, img, allocation.memory, allocation.offset),
+			  "Failed to bind image memory");
 	base_extent = info.extent;
 }
 
@@ -270,8 +266,8 @@ void Texture::destroy() {
 		vkDestroySampler(ctx->device, sampler, nullptr);
 	}
 	vkDestroyImageView(ctx->device, img_view, nullptr);
-	if (img_mem) {
+	if (allocation.memory) {
 		vkDestroyImage(ctx->device, img, nullptr);
-		vkFreeMemory(ctx->device, img_mem, nullptr);
+		ctx->allocator->free(allocation);
 	}
 }
@@ -1,5 +1,8 @@
 #pragma once
 #include "LumenPCH.h"
+#include "MemoryAllocator.h"
+
+class UploadBatch;
 
 struct TextureSettings {
 	VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
@@ -24,7 +27,8 @@ class Texture {
 	inline void set_context(VulkanContext* ctx) { this->ctx = ctx; }
 	VkImage img = VK_NULL_HANDLE;
 	VkImageView img_view = VK_NULL_HANDLE;
-	VkDeviceMemory img_mem = VK_NULL_HANDLE;
+	// Empty for images owned by the swapchain
+	MemoryAllocation allocation;
 	VkSampler sampler = VK_NULL_HANDLE;
 	VulkanContext* ctx;
 
@@ -61,6 +65,10 @@ class Texture2D : public Texture {
 
 	void load_from_data(VulkanContext* ctx, void* data, VkDeviceSize size, const VkImageCreateInfo& info,
 						VkSampler a_sampler, bool generate_mipmaps = true);
+	// Records the upload into the batch, the texture is usable once the batch completes.
+	// Generating mipmaps needs a graphics batch
+	void load_from_data(UploadBatch& batch, VulkanContext* ctx, const void* data, VkDeviceSize size,
+						const VkImageCreateInfo& info, VkSampler a_sampler, bool generate_mipmaps = true);
 	void create_empty_texture(const char* name, VulkanContext* ctx, const TextureSettings& settings,
 							  VkImageLayout img_layout, VkSampler = 0,
 							  VkImageAspectFlags flags = VK_IMAGE_ASPECT_COLOR_BIT);
@@ -7,6 +7,7 @@ class ThreadPool {
 	static auto submit(FunctionType&& f, Args&&... args);
 	static void init();
 	static void destroy();
+	static uint32_t size() { return (uint32_t)threads.size(); }
 
    private:
 	static std::atomic_bool done;
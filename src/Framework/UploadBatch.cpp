@@ -0,0 +1,136 @@
+#include "LumenPCH.h"
+#include "UploadBatch.h"
+#include "VkUtils.h"
+
+UploadBatch::UploadBatch(VulkanContext* ctx, bool graphics) : ctx(ctx), graphics(graphics) {}
+
+UploadBatch::~UploadBatch() {
+	if (recording) {
+		submit();
+	}
+}
+
+UploadBatch::StagingRange UploadBatch::stage(const void* data, VkDeviceSize size, VkDeviceSize alignment) {
+	if (!recording) {
+		rec = ctx->uploader->begin(graphics);
+		recording = true;
+	}
+	VkDeviceSize offset = (chunk_offset + alignment - 1) / alignment * alignment;
+	if (staging_chunks.empty() || offset + size > staging_chunks.back().size) {
+		// Uploads larger than a chunk get a staging buffer of their own
+		auto& chunk = staging_chunks.emplace_back();
+		chunk.create("", ctx, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					 VK_SHARING_MODE_EXCLUSIVE, std::max(size, STAGING_CHUNK_SIZE), nullptr, false,
+					 AllocationStrategy::Linear);
+		offset = 0;
+	}
+	auto& chunk = staging_chunks.back();
+	memcpy((uint8_t*)chunk.data + offset, data, size);
+	chunk_offset = offset + size;
+	num_uploads++;
+	uploaded_size += size;
+	return {chunk.handle, offset};
+}
+
+void UploadBatch::upload(Buffer& dst, const void* data, VkDeviceSize size, VkDeviceSize dst_offset) {
+	if (!size) {
+		return;
+	}
+	// EXCLUSIVE buffers already used by the graphics queue would need a
+	// graphics -> transfer release before this copy
+	LUMEN_ASSERT(!transfers_ownership() || !dst.gfx_owned ||
+					 std::any_of(buffer_releases.begin(), buffer_releases.end(),
+								 [&dst](const VkBufferMemoryBarrier2& release) { return release.buffer == dst.handle; }),
+				 "Uploads on the transfer queue are limited to newly created buffers");
+	const StagingRange staging = stage(data, size);
+	VkBufferCopy copy_region = {};
+	copy_region.srcOffset = staging.offset;
+	copy_region.dstOffset = dst_offset;
+	copy_region.size = size;
+	vkCmdCopyBuffer(rec.cmd, staging.buffer, dst.handle, 1, &copy_region);
+	if (transfers_ownership()) {
+		VkBufferMemoryBarrier2 barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2};
+		barrier.srcQueueFamilyIndex = ctx->uploader->transfer_family();
+		barrier.dstQueueFamilyIndex = ctx->uploader->gfx_family();
+		barrier.buffer = dst.handle;
+		barrier.offset = dst_offset;
+		barrier.size = size;
+		buffer_releases.push_back(barrier);
+		dst.gfx_owned = true;
+	}
+}
+
+void UploadBatch::finish_image(VkImage image, const VkImageSubresourceRange& range) {
+	if (!transfers_ownership()) {
+		transition_image_layout(rec.cmd, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+								VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, range, range.aspectMask);
+		return;
+	}
+	// The layout transition happens as part of the ownership transfer
+	VkImageMemoryBarrier2 barrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcQueueFamilyIndex = ctx->uploader->transfer_family();
+	barrier.dstQueueFamilyIndex = ctx->uploader->gfx_family();
+	barrier.image = image;
+	barrier.subresourceRange = range;
+	image_releases.push_back(barrier);
+}
+
+UploadTicket UploadBatch::submit_async() {
+	if (!recording) {
+		return 0;
+	}
+	VkDependencyInfo dependency_info = {VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+	VkMemoryBarrier2 barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+	std::vector<VkBufferMemoryBarrier2> buffer_acquires;
+	std::vector<VkImageMemoryBarrier2> image_acquires;
+	if (transfers_ownership()) {
+		// Release on the transfer queue, the matching acquire is recorded by the service
+		for (auto& release : buffer_releases) {
+			release.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+			release.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+			auto& acquire = buffer_acquires.emplace_back(release);
+			acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+			acquire.srcAccessMask = VK_ACCESS_2_NONE;
+			acquire.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+			acquire.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+		}
+		for (auto& release : image_releases) {
+			release.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+			release.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+			auto& acquire = image_acquires.emplace_back(release);
+			acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+			acquire.srcAccessMask = VK_ACCESS_2_NONE;
+			acquire.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+			acquire.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+		}
+		dependency_info.bufferMemoryBarrierCount = (uint32_t)buffer_releases.size();
+		dependency_info.pBufferMemoryBarriers = buffer_releases.data();
+		dependency_info.imageMemoryBarrierCount = (uint32_t)image_releases.size();
+		dependency_info.pImageMemoryBarriers = image_releases.data();
+	} else {
+		barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+		barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+		dependency_info.memoryBarrierCount = 1;
+		dependency_info.pMemoryBarriers = &barrier;
+	}
+	vkCmdPipelineBarrier2(rec.cmd, &dependency_info);
+	// Staging chunks are freed by the service once the GPU is done with them
+	const UploadTicket ticket =
+		ctx->uploader->submit(rec, std::move(staging_chunks), buffer_acquires, image_acquires);
+	recording = false;
+	LUMEN_TRACE("Submitted {} uploads ({} KB) as ticket {}", num_uploads, uploaded_size >> 10, ticket);
+	staging_chunks.clear();
+	buffer_releases.clear();
+	image_releases.clear();
+	chunk_offset = 0;
+	num_uploads = 0;
+	uploaded_size = 0;
+	return ticket;
+}
+
+void UploadBatch::submit() { ctx->uploader->wait(submit_async()); }
@@ -0,0 +1,58 @@
+#pragma once
+#include "LumenPCH.h"
+#include "Buffer.h"
+#include "UploadService.h"
+
+// Records any number of buffer and image uploads into a single command buffer
+// that is submitted once. Source data is packed into host visible staging
+// chunks from the allocator's linear pools, so the staging memory of one batch
+// is reused by the next one instead of being allocated per upload. Batches are
+// submitted through the UploadService and run on the transfer queue unless they
+// need graphics commands.
+class UploadBatch {
+   public:
+	static constexpr VkDeviceSize STAGING_CHUNK_SIZE = 16 * 1024 * 1024;
+
+	struct StagingRange {
+		VkBuffer buffer;
+		VkDeviceSize offset;
+	};
+
+	// Graphics batches are recorded for the graphics queue, e.g. to generate mipmaps
+	UploadBatch(VulkanContext* ctx, bool graphics = false);
+	// Submits and waits for whatever is still pending
+	~UploadBatch();
+	UploadBatch(const UploadBatch&) = delete;
+	UploadBatch& operator=(const UploadBatch&) = delete;
+
+	// Copies the data into staging memory and records its copy into the buffer.
+	// On a dedicated transfer queue only buffers that the graphics queue doesn't
+	// own yet can be written, i.e. buffers created for this upload
+	void upload(Buffer& dst, const void* data, VkDeviceSize size, VkDeviceSize dst_offset = 0);
+	// Copies the data into staging memory, the caller records the transfer out of it
+	StagingRange stage(const void* data, VkDeviceSize size, VkDeviceSize alignment = 16);
+	// Moves an image written by the batch from TRANSFER_DST to SHADER_READ_ONLY
+	void finish_image(VkImage image, const VkImageSubresourceRange& range);
+	// Only valid after stage() until the next submit
+	VkCommandBuffer cmd() const { return rec.cmd; }
+	bool supports_graphics() const { return graphics || !ctx->uploader->has_dedicated_queue(); }
+	// Makes the uploads visible to every later command on the graphics queue
+	UploadTicket submit_async();
+	// Same as above, but waits for the uploads to finish
+	void submit();
+
+   private:
+	// Resources written on a dedicated transfer queue change ownership to graphics
+	bool transfers_ownership() const { return !supports_graphics(); }
+
+	VulkanContext* ctx;
+	bool graphics;
+	UploadService::Recording rec;
+	std::vector<Buffer> staging_chunks;
+	std::vector<VkBufferMemoryBarrier2> buffer_releases;
+	std::vector<VkImageMemoryBarrier2> image_releases;
+	VkDeviceSize chunk_offset = 0;
+	bool recording = false;
+	uint32_t num_uploads = 0;
+	VkDeviceSize uploaded_size = 0;
+};
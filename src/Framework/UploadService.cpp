@@ -0,0 +1,209 @@
+#include "LumenPCH.h"
+#include "UploadService.h"
+
+UploadService::~UploadService() { destroy(); }
+
+VkSemaphore UploadService::create_timeline() {
+	VkSemaphoreTypeCreateInfo type_info = {VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+	type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	type_info.initialValue = 0;
+	VkSemaphoreCreateInfo semaphore_info = vk::semaphore_create_info();
+	semaphore_info.pNext = &type_info;
+	VkSemaphore semaphore;
+	vk::check(vkCreateSemaphore(ctx->device, &semaphore_info, nullptr, &semaphore),
+			  "Failed to create timeline semaphore");
+	return semaphore;
+}
+
+void UploadService::init(VulkanContext* ctx) {
+	this->ctx = ctx;
+	gfx_family_idx = ctx->indices.gfx_family.value();
+	transfer_family_idx = ctx->indices.transfer_family.value();
+	dedicated = transfer_family_idx != gfx_family_idx;
+	complete_sem = create_timeline();
+	if (dedicated) {
+		transfer_sem = create_timeline();
+	}
+	LUMEN_TRACE("Uploads use queue family {}{}", transfer_family_idx, dedicated ? " (dedicated)" : "");
+}
+
+void UploadService::destroy() {
+	if (!ctx || !complete_sem) {
+		return;
+	}
+	wait(last_ticket);
+	for (auto& slot : free_transfer_slots) {
+		vkDestroyCommandPool(ctx->device, slot.pool, nullptr);
+	}
+	for (auto& slot : free_gfx_slots) {
+		vkDestroyCommandPool(ctx->device, slot.pool, nullptr);
+	}
+	free_transfer_slots.clear();
+	free_gfx_slots.clear();
+	vkDestroySemaphore(ctx->device, complete_sem, nullptr);
+	if (transfer_sem) {
+		vkDestroySemaphore(ctx->device, transfer_sem, nullptr);
+	}
+	complete_sem = VK_NULL_HANDLE;
+	transfer_sem = VK_NULL_HANDLE;
+}
+
+UploadService::CommandSlot UploadService::get_slot(bool graphics) {
+	auto& free_slots = graphics ? free_gfx_slots : free_transfer_slots;
+	if (!free_slots.empty()) {
+		CommandSlot slot = free_slots.back();
+		free_slots.pop_back();
+		return slot;
+	}
+	// One transient pool per in-flight batch, so that recycling is a pool reset
+	VkCommandPoolCreateInfo pool_info = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+	pool_info.queueFamilyIndex = graphics ? gfx_family_idx : transfer_family_idx;
+	pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	CommandSlot slot;
+	vk::check(vkCreateCommandPool(ctx->device, &pool_info, nullptr, &slot.pool), "Failed to create command pool");
+	auto alloc_info = vk::command_buffer_allocate_info(slot.pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+	vk::check(vkAllocateCommandBuffers(ctx->device, &alloc_info, &slot.cmd), "Could not allocate command buffer");
+	return slot;
+}
+
+void UploadService::release_slot(const CommandSlot& slot, bool graphics) {
+	vk::check(vkResetCommandPool(ctx->device, slot.pool, 0), "Failed to reset command pool");
+	(graphics ? free_gfx_slots : free_transfer_slots).push_back(slot);
+}
+
+UploadService::Recording UploadService::begin(bool graphics) {
+	std::lock_guard<std::mutex> lock(mutex);
+	collect();
+	// Without a dedicated family both slot kinds come from the graphics family anyway
+	const CommandSlot slot = get_slot(graphics || !dedicated);
+	Recording rec;
+	rec.pool = slot.pool;
+	rec.cmd = slot.cmd;
+	rec.graphics = graphics || !dedicated;
+	auto begin_info = vk::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	vk::check(vkBeginCommandBuffer(rec.cmd, &begin_info), "Could not begin the command buffer");
+	return rec;
+}
+
+UploadTicket UploadService::submit(Recording& rec, std::vector<Buffer>&& staging,
+								   const std::vector<VkBufferMemoryBarrier2>& buffer_acquires,
+								   const std::vector<VkImageMemoryBarrier2>& image_acquires) {
+	vk::check(vkEndCommandBuffer(rec.cmd), "Failed to end command buffer");
+	std::lock_guard<std::mutex> lock(mutex);
+	PendingBatch batch;
+	batch.rec = rec;
+	batch.acquire = {VK_NULL_HANDLE, VK_NULL_HANDLE};
+	batch.staging = std::move(staging);
+	batch.ticket = ++last_ticket;
+
+	VkCommandBufferSubmitInfo copy_cmd_info = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO};
+	copy_cmd_info.commandBuffer = rec.cmd;
+	VkSemaphoreSubmitInfo complete_signal = {VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO};
+	complete_signal.semaphore = complete_sem;
+	complete_signal.value = batch.ticket;
+	complete_signal.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+	std::lock_guard<std::mutex> queue_lock(VulkanSyncronization::queue_mutex);
+	if (rec.graphics) {
+		VkSubmitInfo2 submit_info = {VK_STRUCTURE_TYPE_SUBMIT_INFO_2};
+		submit_info.commandBufferInfoCount = 1;
+		submit_info.pCommandBufferInfos = &copy_cmd_info;
+		submit_info.signalSemaphoreInfoCount = 1;
+		submit_info.pSignalSemaphoreInfos = &complete_signal;
+		vk::check(vkQueueSubmit2(ctx->queues[(int)QueueType::GFX], 1, &submit_info, VK_NULL_HANDLE),
+				  "Queue submission error");
+	} else {
+		VkSemaphoreSubmitInfo transfer_signal = {VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO};
+		transfer_signal.semaphore = transfer_sem;
+		transfer_signal.value = ++transfer_value;
+		transfer_signal.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		VkSubmitInfo2 copy_submit = {VK_STRUCTURE_TYPE_SUBMIT_INFO_2};
+		copy_submit.commandBufferInfoCount = 1;
+		copy_submit.pCommandBufferInfos = &copy_cmd_info;
+		copy_submit.signalSemaphoreInfoCount = 1;
+		copy_submit.pSignalSemaphoreInfos = &transfer_signal;
+		vk::check(vkQueueSubmit2(ctx->queues[(int)QueueType::TRANSFER], 1, &copy_submit, VK_NULL_HANDLE),
+				  "Queue submission error");
+
+		// The graphics queue takes ownership and signals completion, even when there is
+		// nothing to acquire, so that the completion semaphore is only ever signaled in order
+		VkCommandBufferSubmitInfo acquire_cmd_info = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO};
+		if (!buffer_acquires.empty() || !image_acquires.empty()) {
+			batch.acquire = get_slot(true);
+			auto begin_info = vk::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+			vk::check(vkBeginCommandBuffer(batch.acquire.cmd, &begin_info), "Could not begin the command buffer");
+			VkDependencyInfo dependency_info = {VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+			dependency_info.bufferMemoryBarrierCount = (uint32_t)buffer_acquires.size();
+			dependency_info.pBufferMemoryBarriers = buffer_acquires.data();
+			dependency_info.imageMemoryBarrierCount = (uint32_t)image_acquires.size();
+			dependency_info.pImageMemoryBarriers = image_acquires.data();
+			vkCmdPipelineBarrier2(batch.acquire.cmd, &dependency_info);
+			vk::check(vkEndCommandBuffer(batch.acquire.cmd), "Failed to end command buffer");
+			acquire_cmd_info.commandBuffer = batch.acquire.cmd;
+		}
+		VkSemaphoreSubmitInfo transfer_wait = transfer_signal;
+		VkSubmitInfo2 acquire_submit = {VK_STRUCTURE_TYPE_SUBMIT_INFO_2};
+		acquire_submit.waitSemaphoreInfoCount = 1;
+		acquire_submit.pWaitSemaphoreInfos = &transfer_wait;
+		acquire_submit.commandBufferInfoCount = batch.acquire.cmd ? 1 : 0;
+		acquire_submit.pCommandBufferInfos = &acquire_cmd_info;
+		acquire_submit.signalSemaphoreInfoCount = 1;
+		acquire_submit.pSignalSemaphoreInfos = &complete_signal;
+		vk::check(vkQueueSubmit2(ctx->queues[(int)QueueType::GFX], 1, &acquire_submit, VK_NULL_HANDLE),
+				  "Queue submission error");
+	}
+	pending.push_back(std::move(batch));
+	rec = {};
+	return last_ticket;
+}
+
+bool UploadService::is_complete(UploadTicket ticket) {
+	uint64_t value = 0;
+	vk::check(vkGetSemaphoreCounterValue(ctx->device, complete_sem, &value), "Failed to query timeline semaphore");
+	return value >= ticket;
+}
+
+void UploadService::wait(UploadTicket ticket) {
+	if (ticket) {
+		VkSemaphoreWaitInfo wait_info = {VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+		wait_info.semaphoreCount = 1;
+		wait_info.pSemaphores = &complete_sem;
+		wait_info.pValues = &ticket;
+		vk::check(vkWaitSemaphores(ctx->device, &wait_info, UINT64_MAX), "Upload wait error");
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	collect();
+}
+
+void UploadService::wait_on_frame(UploadTicket ticket) {
+	std::lock_guard<std::mutex> lock(mutex);
+	frame_wait = std::max(frame_wait, ticket);
+}
+
+UploadTicket UploadService::frame_wait_ticket() {
+	std::lock_guard<std::mutex> lock(mutex);
+	// Kept until it completes, frames later in the queue may start before the one that waited
+	if (frame_wait && is_complete(frame_wait)) {
+		frame_wait = 0;
+	}
+	return frame_wait;
+}
+
+void UploadService::collect() {
+	if (pending.empty()) {
+		return;
+	}
+	uint64_t value = 0;
+	vk::check(vkGetSemaphoreCounterValue(ctx->device, complete_sem, &value), "Failed to query timeline semaphore");
+	while (!pending.empty() && pending.front().ticket <= value) {
+		auto& batch = pending.front();
+		for (auto& buffer : batch.staging) {
+			buffer.destroy();
+		}
+		release_slot({batch.rec.pool, batch.rec.cmd}, batch.rec.graphics);
+		if (batch.acquire.pool) {
+			release_slot(batch.acquire, true);
+		}
+		pending.pop_front();
+	}
+}
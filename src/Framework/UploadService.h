@@ -0,0 +1,81 @@
+#pragma once
+#include "LumenPCH.h"
+#include "Buffer.h"
+#include <deque>
+
+// Value of the completion timeline semaphore that marks an upload as done. Zero is
+// always complete
+using UploadTicket = uint64_t;
+
+// Submits upload batches without blocking the caller. Copies run on the transfer
+// queue; on devices with a dedicated transfer family, an acquire submission on the
+// graphics queue hands ownership of the resources over to it. Every batch ends with
+// a signal of the completion timeline semaphore on the graphics queue, so signals
+// stay ordered and a ticket can be waited on from the host or from a frame.
+class UploadService {
+   public:
+	struct Recording {
+		VkCommandPool pool = VK_NULL_HANDLE;
+		VkCommandBuffer cmd = VK_NULL_HANDLE;
+		// Recorded for the graphics queue, needed for blits
+		bool graphics = false;
+	};
+
+	UploadService() = default;
+	~UploadService();
+	void init(VulkanContext* ctx);
+	void destroy();
+
+	// Resources recorded on the transfer queue change queue family ownership
+	bool has_dedicated_queue() const { return dedicated; }
+	uint32_t transfer_family() const { return transfer_family_idx; }
+	uint32_t gfx_family() const { return gfx_family_idx; }
+	// Completion timeline semaphore, for submissions that wait on a ticket
+	VkSemaphore get_semaphore() const { return complete_sem; }
+
+	Recording begin(bool graphics);
+	// Takes ownership of the staging buffers and frees them once the batch completes.
+	// The acquire barriers are recorded on the graphics queue after the copies
+	UploadTicket submit(Recording& rec, std::vector<Buffer>&& staging,
+						const std::vector<VkBufferMemoryBarrier2>& buffer_acquires,
+						const std::vector<VkImageMemoryBarrier2>& image_acquires);
+	bool is_complete(UploadTicket ticket);
+	void wait(UploadTicket ticket);
+	// Frame submissions wait on the ticket on the GPU instead of the host
+	void wait_on_frame(UploadTicket ticket);
+	// Called by the frame submission, returns 0 once the ticket has completed
+	UploadTicket frame_wait_ticket();
+
+   private:
+	struct CommandSlot {
+		VkCommandPool pool;
+		VkCommandBuffer cmd;
+	};
+	struct PendingBatch {
+		UploadTicket ticket;
+		Recording rec;
+		CommandSlot acquire;
+		std::vector<Buffer> staging;
+	};
+	CommandSlot get_slot(bool graphics);
+	void release_slot(const CommandSlot& slot, bool graphics);
+	VkSemaphore create_timeline();
+	// Recycles everything the GPU is done with, expects the mutex to be held
+	void collect();
+
+	VulkanContext* ctx = nullptr;
+	bool dedicated = false;
+	uint32_t transfer_family_idx = 0;
+	uint32_t gfx_family_idx = 0;
+	// Signaled by the transfer queue, only used with a dedicated family
+	VkSemaphore transfer_sem = VK_NULL_HANDLE;
+	uint64_t transfer_value = 0;
+	// Signaled by the graphics queue at the end of every batch
+	VkSemaphore complete_sem = VK_NULL_HANDLE;
+	UploadTicket last_ticket = 0;
+	UploadTicket frame_wait = 0;
+	std::vector<CommandSlot> free_transfer_slots;
+	std::vector<CommandSlot> free_gfx_slots;
+	std::deque<PendingBatch> pending;
+	std::mutex mutex;
+};
@@ -263,7 +263,7 @@ BlasInput to_vk_geometry(LumenPrimMesh& prim, VkDeviceAddress vertex_address, Vk
 	// Indicate identity transform by setting transformData to null device
 	// pointer.
 	// triangles.transformData = {};
-	triangles.maxVertex = prim.vtx_count;
+	triangles.maxVertex = prim.vtx_count ? prim.vtx_count - 1 : 0;  // Highest index in the welded mesh
 
 	// Identify the above data as containing opaque triangles.
 	VkAccelerationStructureGeometryKHR asGeom{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR};
@@ -27,11 +27,13 @@ bool has_flag(VkFlags item, VkFlags flag) { return (item & flag) == flag; }
 VulkanBase::VulkanBase(bool debug) { this->enable_validation_layers = debug; }
 
 std::vector<const char*> VulkanBase::get_req_extensions() {
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	std::vector<const char*> extensions;
+	if (!headless) {
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
 
 	if (enable_validation_layers) {
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -57,7 +59,12 @@ QueueFamilyIndices VulkanBase::find_queue_families(VkPhysicalDevice device) {
 		}
 
 		VkBool32 present_support = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, ctx.surface, &present_support);
+		if (headless) {
+			// Nothing is presented, the graphics family stands in for the present family
+			present_support = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+		} else {
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, ctx.surface, &present_support);
+		}
 
 		if (present_support) {
 			indices.present_family = i;
@@ -69,6 +76,17 @@ QueueFamilyIndices VulkanBase::find_queue_families(VkPhysicalDevice device) {
 
 		i++;
 	}
+	// Dedicated DMA queues copy without contending with rendering
+	for (uint32_t family = 0; family < queue_family_count; family++) {
+		const VkQueueFlags flags = queue_families[family].queueFlags;
+		if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+			indices.transfer_family = family;
+			break;
+		}
+	}
+	if (!indices.transfer_family.has_value()) {
+		indices.transfer_family = indices.gfx_family;
+	}
 	return indices;
 }
 
@@ -169,6 +187,9 @@ void VulkanBase::cleanup_swapchain() {
 	//}
 	vkFreeCommandBuffers(ctx.device, ctx.cmd_pools[0], static_cast<uint32_t>(ctx.command_buffers.size()),
 						 ctx.command_buffers.data());
+	if (headless) {
+		return;
+	}
 	vkDestroyPipeline(ctx.device, ctx.gfx_pipeline, nullptr);
 	vkDestroyPipelineLayout(ctx.device, ctx.pipeline_layout, nullptr);
 	vkDestroyRenderPass(ctx.device, ctx.default_render_pass, nullptr);
@@ -181,16 +202,7 @@ void VulkanBase::cleanup_swapchain() {
 void VulkanBase::cleanup() {
 	// TODO: Move up
 	rg->destroy();
-	if (!blases.empty()) {
-		for (auto& b : blases) {
-			b.buffer.destroy();
-			vkDestroyAccelerationStructureKHR(ctx.device, b.accel, nullptr);
-		}
-	}
-	if (tlas.buffer.ctx) {
-		tlas.buffer.destroy();
-		vkDestroyAccelerationStructureKHR(ctx.device, tlas.accel, nullptr);
-	}
+	destroy_acceleration_structures();
 	cleanup_swapchain();
 
 	vkDestroyImageView(ctx.device, ctx.depth_img_view, nullptr);
@@ -206,15 +218,49 @@ void VulkanBase::cleanup() {
 	for (auto pool : ctx.cmd_pools) {
 		vkDestroyCommandPool(ctx.device, pool, nullptr);
 	}
-	vkDestroySurfaceKHR(ctx.instance, ctx.surface, nullptr);
+	cmd_buffer_pool.destroy();
+	save_pipeline_cache();
+	vkDestroyPipelineCache(ctx.device, ctx.pipeline_cache, nullptr);
+	uploader.destroy();
+	allocator.destroy();
+	if (!headless) {
+		vkDestroySurfaceKHR(ctx.instance, ctx.surface, nullptr);
+	}
 
 	vkDestroyDevice(ctx.device, nullptr);
 	if (enable_validation_layers) {
 		vkExt_destroy_debug_messenger(ctx.instance, ctx.debug_messenger, nullptr);
 	}
 	vkDestroyInstance(ctx.instance, nullptr);
-	glfwDestroyWindow(ctx.window_ptr);
-	glfwTerminate();
+	if (!headless) {
+		glfwDestroyWindow(ctx.window_ptr);
+		glfwTerminate();
+	}
+}
+
+void VulkanBase::destroy_acceleration_structures() {
+	for (auto& b : blases) {
+		b.buffer.destroy();
+		vkDestroyAccelerationStructureKHR(ctx.device, b.accel, nullptr);
+	}
+	blases.clear();
+	if (tlas.buffer.ctx) {
+		tlas.buffer.destroy();
+		vkDestroyAccelerationStructureKHR(ctx.device, tlas.accel, nullptr);
+	}
+	tlas = {};
+	tlas_instance_buffer.destroy();
+	tlas_scratch_buffer.destroy();
+	tlas_instance_buffer = {};
+	tlas_scratch_buffer = {};
+	tlas_instance_count = 0;
+	tlas_refits = 0;
+}
+
+void VulkanBase::enable_headless() {
+	headless = true;
+	std::erase_if(device_extensions,
+				  [](const char* name) { return strcmp(name, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0; });
 }
 
 void VulkanBase::create_instance() {
@@ -289,8 +335,8 @@ void VulkanBase::pick_physical_device() {
 		}(device);
 
 		// Query swaphcain support
-		bool swapchain_adequate = false;
-		if (extensions_supported) {
+		bool swapchain_adequate = headless;
+		if (extensions_supported && !headless) {
 			SwapChainSupportDetails swapchain_support = query_swapchain_support(device);
 			// If we have a format and present mode, it's adequate
 			swapchain_adequate = !swapchain_support.formats.empty() && !swapchain_support.present_modes.empty();
@@ -314,6 +360,7 @@ void VulkanBase::pick_physical_device() {
 	}
 	VkPhysicalDeviceProperties2 prop2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
 	prop2.pNext = &ctx.rt_props;
+	ctx.rt_props.pNext = &ctx.as_props;
 	vkGetPhysicalDeviceProperties2(ctx.physical_device, &prop2);
 }
 
@@ -322,10 +369,11 @@ void VulkanBase::create_logical_device() {
 
 	std::vector<VkDeviceQueueCreateInfo> queue_CIs;
 	std::set<uint32_t> unique_queue_families = {ctx.indices.gfx_family.value(), ctx.indices.present_family.value(),
-												ctx.indices.compute_family.value()};
+												ctx.indices.compute_family.value(),
+												ctx.indices.transfer_family.value()};
 
 	ctx.queues.resize(ctx.indices.gfx_family.has_value() + ctx.indices.present_family.has_value() +
-					  ctx.indices.compute_family.has_value());
+					  ctx.indices.compute_family.has_value() + ctx.indices.transfer_family.has_value());
 	float queue_priority = 1.0f;
 	for (uint32_t queue_family_idx : unique_queue_families) {
 		VkDeviceQueueCreateInfo queue_CI{};
@@ -363,10 +411,23 @@ void VulkanBase::create_logical_device() {
 	atomic_fts.shaderSharedFloat32Atomics = true;
 	atomic_fts.pNext = nullptr;
 	accel_fts.accelerationStructure = true;
+	if (host_as_builds) {
+		VkPhysicalDeviceAccelerationStructureFeaturesKHR supported_accel_fts{
+			VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR};
+		VkPhysicalDeviceFeatures2 supported_features2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
+		supported_features2.pNext = &supported_accel_fts;
+		vkGetPhysicalDeviceFeatures2(ctx.physical_device, &supported_features2);
+		host_as_builds = supported_accel_fts.accelerationStructureHostCommands;
+		if (!host_as_builds) {
+			LUMEN_WARN("The device doesn't support host acceleration structure commands, building on the device");
+		}
+	}
+	accel_fts.accelerationStructureHostCommands = host_as_builds;
 	accel_fts.pNext = &atomic_fts;
 	rt_fts.rayTracingPipeline = true;
 	rt_fts.pNext = &accel_fts;
 	features12.bufferDeviceAddress = true;
+	features12.timelineSemaphore = true;
 	features12.runtimeDescriptorArray = true;
 	features12.shaderSampledImageArrayNonUniformIndexing = true;
 	if (1) {
@@ -416,6 +477,11 @@ void VulkanBase::create_logical_device() {
 	vkGetDeviceQueue(ctx.device, ctx.indices.gfx_family.value(), 0, &ctx.queues[(int)QueueType::GFX]);
 	vkGetDeviceQueue(ctx.device, ctx.indices.compute_family.value(), 0, &ctx.queues[(int)QueueType::COMPUTE]);
 	vkGetDeviceQueue(ctx.device, ctx.indices.present_family.value(), 0, &ctx.queues[(int)QueueType::PRESENT]);
+	vkGetDeviceQueue(ctx.device, ctx.indices.transfer_family.value(), 0, &ctx.queues[(int)QueueType::TRANSFER]);
+	allocator.init(&ctx);
+	ctx.allocator = &allocator;
+	uploader.init(&ctx);
+	ctx.uploader = &uploader;
 }
 
 void VulkanBase::create_swapchain() {
@@ -536,17 +602,126 @@ void VulkanBase::create_command_pools() {
 	QueueFamilyIndices queue_family_idxs = find_queue_families(ctx.physical_device);
 	VkCommandPoolCreateInfo pool_info = vk::command_pool_CI(VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 	pool_info.queueFamilyIndex = queue_family_idxs.gfx_family.value();
-	const auto processor_count = std::thread::hardware_concurrency();
-	ctx.cmd_pools.resize(processor_count);
-	for (unsigned int i = 0; i < processor_count; i++) {
-		vk::check(vkCreateCommandPool(ctx.device, &pool_info, nullptr, &ctx.cmd_pools[i]),
-				  "Failed to create command pool!");
+	ctx.cmd_pools.resize(1);
+	vk::check(vkCreateCommandPool(ctx.device, &pool_info, nullptr, &ctx.cmd_pools[0]),
+			  "Failed to create command pool!");
+	// Everything else records from per-thread pools
+	cmd_buffer_pool.init(&ctx);
+	ctx.cmd_buffer_pool = &cmd_buffer_pool;
+}
+
+// Prepended to the driver's cache data on disk. The driver only rejects a
+// mismatching vendor/device/UUID, we also invalidate on driver updates
+struct PipelineCacheFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vendor_id;
+	uint32_t device_id;
+	uint32_t driver_version;
+	uint8_t uuid[VK_UUID_SIZE];
+	uint64_t data_size;
+};
+static constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x43504C4C;  // "LLPC"
+static constexpr uint32_t PIPELINE_CACHE_VERSION = 1;
+static const char* PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+static PipelineCacheFileHeader make_pipeline_cache_header(const VkPhysicalDeviceProperties& props) {
+	PipelineCacheFileHeader header{};
+	header.magic = PIPELINE_CACHE_MAGIC;
+	header.version = PIPELINE_CACHE_VERSION;
+	header.vendor_id = props.vendorID;
+	header.device_id = props.deviceID;
+	header.driver_version = props.driverVersion;
+	memcpy(header.uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+	return header;
+}
+
+void VulkanBase::create_pipeline_cache() {
+	const PipelineCacheFileHeader expected = make_pipeline_cache_header(ctx.device_properties);
+	std::vector<char> initial_data;
+	std::ifstream fin(PIPELINE_CACHE_PATH, std::ios::binary | std::ios::ate);
+	if (fin) {
+		const size_t file_size = (size_t)fin.tellg();
+		PipelineCacheFileHeader header{};
+		fin.seekg(0);
+		if (file_size > sizeof(header) && fin.read((char*)&header, sizeof(header)) &&
+			header.magic == expected.magic && header.version == expected.version &&
+			header.vendor_id == expected.vendor_id && header.device_id == expected.device_id &&
+			header.driver_version == expected.driver_version &&
+			memcmp(header.uuid, expected.uuid, VK_UUID_SIZE) == 0 &&
+			header.data_size == file_size - sizeof(header)) {
+			initial_data.resize(header.data_size);
+			fin.read(initial_data.data(), initial_data.size());
+			// Validate the driver's own header as well
+			VkPipelineCacheHeaderVersionOne driver_header{};
+			if (!fin || initial_data.size() < sizeof(driver_header)) {
+				initial_data.clear();
+			} else {
+				memcpy(&driver_header, initial_data.data(), sizeof(driver_header));
+				if (driver_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+					driver_header.vendorID != expected.vendor_id || driver_header.deviceID != expected.device_id ||
+					memcmp(driver_header.pipelineCacheUUID, expected.uuid, VK_UUID_SIZE) != 0) {
+					initial_data.clear();
+				}
+			}
+		}
+		if (initial_data.empty()) {
+			LUMEN_TRACE("Discarding pipeline cache from a different device or driver");
+		}
+	}
+	VkPipelineCacheCreateInfo cache_ci{VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+	cache_ci.initialDataSize = initial_data.size();
+	cache_ci.pInitialData = initial_data.empty() ? nullptr : initial_data.data();
+	if (vkCreatePipelineCache(ctx.device, &cache_ci, nullptr, &ctx.pipeline_cache) != VK_SUCCESS) {
+		// The driver may still reject the data, start from an empty cache then
+		cache_ci.initialDataSize = 0;
+		cache_ci.pInitialData = nullptr;
+		vk::check(vkCreatePipelineCache(ctx.device, &cache_ci, nullptr, &ctx.pipeline_cache),
+				  "Failed to create pipeline cache!");
+	} else if (!initial_data.empty()) {
+		LUMEN_TRACE("Loaded pipeline cache ({} bytes)", initial_data.size());
 	}
 }
 
+void VulkanBase::save_pipeline_cache() {
+	if (ctx.pipeline_cache == VK_NULL_HANDLE) {
+		return;
+	}
+	size_t data_size = 0;
+	if (vkGetPipelineCacheData(ctx.device, ctx.pipeline_cache, &data_size, nullptr) != VK_SUCCESS || !data_size) {
+		return;
+	}
+	std::vector<char> data(data_size);
+	if (vkGetPipelineCacheData(ctx.device, ctx.pipeline_cache, &data_size, data.data()) != VK_SUCCESS) {
+		return;
+	}
+	PipelineCacheFileHeader header = make_pipeline_cache_header(ctx.device_properties);
+	header.data_size = data_size;
+	// Written to a temporary first so that an interrupted write never leaves a
+	// truncated cache behind
+	const std::string tmp_path = std::string(PIPELINE_CACHE_PATH) + ".tmp";
+	std::error_code ec;
+	{
+		std::ofstream fout(tmp_path, std::ios::binary | std::ios::trunc);
+		fout.write((const char*)&header, sizeof(header));
+		fout.write(data.data(), data_size);
+		if (!fout) {
+			LUMEN_WARN("Could not write the pipeline cache");
+			fout.close();
+			std::filesystem::remove(tmp_path, ec);
+			return;
+		}
+	}
+	std::filesystem::rename(tmp_path, PIPELINE_CACHE_PATH, ec);
+	if (ec) {
+		LUMEN_WARN("Could not write the pipeline cache: {}", ec.message());
+		std::filesystem::remove(tmp_path, ec);
+	}
+}
 
 void VulkanBase::create_command_buffers() {
-	ctx.command_buffers.resize(swapchain_images.size());
+	// Without a swapchain, frames cycle through one command buffer per frame in flight
+	ctx.command_buffers.resize(headless ? MAX_FRAMES_IN_FLIGHT : swapchain_images.size());
 	// TODO: Factor
 	// 0 is for the main thread
 	VkCommandBufferAllocateInfo alloc_info = vk::command_buffer_allocate_info(
@@ -611,13 +786,14 @@ bool VulkanBase::check_validation_layer_support() {
 	return true;
 }
 
-AccelKHR VulkanBase::create_acceleration(VkAccelerationStructureCreateInfoKHR& accel) {
+AccelKHR VulkanBase::create_acceleration(VkAccelerationStructureCreateInfoKHR& accel,
+										  VkMemoryPropertyFlags mem_flags) {
 	AccelKHR result_accel;
 	// Allocating the buffer to hold the acceleration structure
 	Buffer accel_buff;
 	accel_buff.create(
 		&ctx, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE, accel.size);
+		mem_flags, VK_SHARING_MODE_EXCLUSIVE, accel.size);
 	// Setting the buffer
 	result_accel.buffer = accel_buff;
 	accel.buffer = result_accel.buffer.handle;
@@ -635,7 +811,7 @@ void VulkanBase::cmd_compact_blas(VkCommandBuffer cmdBuf, std::vector<uint32_t>
 	std::vector<VkDeviceSize> compact_sizes(static_cast<uint32_t>(indices.size()));
 	vkGetQueryPoolResults(ctx.device, queryPool, 0, (uint32_t)compact_sizes.size(),
 						  compact_sizes.size() * sizeof(VkDeviceSize), compact_sizes.data(), sizeof(VkDeviceSize),
-						  VK_QUERY_RESULT_WAIT_BIT);
+						  VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_64_BIT);
 
 	for (auto idx : indices) {
 		buildAs[idx].cleanup_as = buildAs[idx].as;										// previous AS to destroy
@@ -656,40 +832,64 @@ void VulkanBase::cmd_compact_blas(VkCommandBuffer cmdBuf, std::vector<uint32_t>
 
 void VulkanBase::cmd_create_blas(VkCommandBuffer cmdBuf, std::vector<uint32_t> indices,
 								 std::vector<BuildAccelerationStructure>& buildAs, VkDeviceAddress scratchAddress,
-								 VkQueryPool queryPool) {
-	if (queryPool)	// For querying the compaction size
-		vkResetQueryPool(ctx.device, queryPool, 0, static_cast<uint32_t>(indices.size()));
+								 VkDeviceSize scratchSize, VkQueryPool queryPool) {
+	// For querying the compaction size. Reset on the device, host resets need the hostQueryReset feature
+	if (queryPool)
+		vkCmdResetQueryPool(cmdBuf, queryPool, 0, static_cast<uint32_t>(indices.size()));
+	const VkDeviceSize alignment = ctx.as_props.minAccelerationStructureScratchOffsetAlignment;
 	uint32_t query_cnt{0};
-	for (const auto& idx : indices) {
-		// Actual allocation of buffer and acceleration structure.
-		VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
-		createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-		createInfo.size = buildAs[idx].size_info.accelerationStructureSize;	 // Will be used to allocate memory.
-		buildAs[idx].as = create_acceleration(createInfo);
-		// BuildInfo #2 part
-		buildAs[idx].build_info.dstAccelerationStructure = buildAs[idx].as.accel;  // Setting where the build lands
-		buildAs[idx].build_info.scratchData.deviceAddress =
-			scratchAddress;	 // All build are using the same scratch buffer
-		// Building the bottom-level-acceleration-structure
-		vkCmdBuildAccelerationStructuresKHR(cmdBuf, 1, &buildAs[idx].build_info, &buildAs[idx].range_info);
-
-		// Since the scratch buffer is reused across builds, we need a barrier
-		// to ensure one build is finished before starting the next one.
+	// Builds of the current group, each one in its own region of the scratch buffer
+	std::vector<VkAccelerationStructureBuildGeometryInfoKHR> build_infos;
+	std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> range_infos;
+	std::vector<VkAccelerationStructureKHR> group_as;
+	VkDeviceSize scratch_offset{0};
+	auto flush_group = [&]() {
+		if (build_infos.empty()) {
+			return;
+		}
+		// Builds of a single call don't depend on each other, so the device can run them concurrently
+		vkCmdBuildAccelerationStructuresKHR(cmdBuf, (uint32_t)build_infos.size(), build_infos.data(),
+											range_infos.data());
+		// Since the scratch buffer is reused by the next group, we need a barrier
+		// to ensure the builds are finished before starting the next ones.
 		VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
 		barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
 		barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
 		vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
 							 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0,
 							 nullptr);
-
 		if (queryPool) {
 			// Add a query to find the 'real' amount of memory needed, use for
 			// compaction
-			vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuf, 1, &buildAs[idx].build_info.dstAccelerationStructure,
+			vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuf, (uint32_t)group_as.size(), group_as.data(),
 														  VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
-														  queryPool, query_cnt++);
+														  queryPool, query_cnt);
+			query_cnt += (uint32_t)group_as.size();
+		}
+		build_infos.clear();
+		range_infos.clear();
+		group_as.clear();
+		scratch_offset = 0;
+	};
+	for (const auto& idx : indices) {
+		const VkDeviceSize scratch_size = align_up(buildAs[idx].size_info.buildScratchSize, alignment);
+		if (scratch_offset + scratch_size > scratchSize) {
+			flush_group();
 		}
+		// Actual allocation of buffer and acceleration structure.
+		VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+		createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		createInfo.size = buildAs[idx].size_info.accelerationStructureSize;	 // Will be used to allocate memory.
+		buildAs[idx].as = create_acceleration(createInfo);
+		// BuildInfo #2 part
+		buildAs[idx].build_info.dstAccelerationStructure = buildAs[idx].as.accel;  // Setting where the build lands
+		buildAs[idx].build_info.scratchData.deviceAddress = scratchAddress + scratch_offset;
+		scratch_offset += scratch_size;
+		build_infos.push_back(buildAs[idx].build_info);
+		range_infos.push_back(buildAs[idx].range_info);
+		group_as.push_back(buildAs[idx].as.accel);
 	}
+	flush_group();
 }
 
 void VulkanBase::cmd_create_tlas(VkCommandBuffer cmdBuf, uint32_t countInstance, Buffer& scratchBuffer,
@@ -726,19 +926,24 @@ void VulkanBase::cmd_create_tlas(VkCommandBuffer cmdBuf, uint32_t countInstance,
 	motionInfo.maxInstances = countInstance;
 #endif
 
-	// Create TLAS
-	if (update == false) {
+	// Create TLAS, rebuilds of the same instances land in the existing one
+	if (update == false && !tlas.accel) {
 		VkAccelerationStructureCreateInfoKHR create_info{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
 		create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
 		create_info.size = size_info.accelerationStructureSize;
 		tlas = create_acceleration(create_info);
 	}
-
-	// Allocate the scratch memory
-	scratchBuffer.create(&ctx, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-						 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE, size_info.buildScratchSize);
+	LUMEN_ASSERT(tlas.buffer.size >= size_info.accelerationStructureSize, "The TLAS is too small for its instances");
+
+	// Allocate the scratch memory, large enough for both builds and updates when it is kept
+	const VkDeviceSize scratch_alignment = ctx.as_props.minAccelerationStructureScratchOffsetAlignment;
+	if (!scratchBuffer.handle) {
+		scratchBuffer.create(&ctx, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+							 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE,
+							 std::max(size_info.buildScratchSize, size_info.updateScratchSize) + scratch_alignment);
+	}
 	VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr, scratchBuffer.handle};
-	VkDeviceAddress scratchAddress = vkGetBufferDeviceAddress(ctx.device, &bufferInfo);
+	VkDeviceAddress scratchAddress = align_up(vkGetBufferDeviceAddress(ctx.device, &bufferInfo), scratch_alignment);
 
 	// Update build information
 	build_info.srcAccelerationStructure = update ? tlas.accel : VK_NULL_HANDLE;
@@ -767,6 +972,8 @@ void VulkanBase::build_blas(const std::vector<BlasInput>& input, VkBuildAccelera
 	VkDeviceSize as_total_size{0};	   // Memory size of all allocated BLAS
 	uint32_t nb_compactions{0};		   // Nb of BLAS requesting compaction
 	VkDeviceSize max_scratch_size{0};  // Largest scratch size
+	VkDeviceSize total_scratch_size{0};	 // Scratch size of building everything at once
+	const VkDeviceSize scratch_alignment = ctx.as_props.minAccelerationStructureScratchOffsetAlignment;
 
 	// Preparing the information for the acceleration build commands.
 	std::vector<BuildAccelerationStructure> buildAs(nb_blas);
@@ -788,23 +995,39 @@ void VulkanBase::build_blas(const std::vector<BlasInput>& input, VkBuildAccelera
 		for (auto tt = 0; tt < input[idx].as_build_offset_info.size(); tt++) {
 			maxPrimCount[tt] = input[idx].as_build_offset_info[tt].primitiveCount;	// Number of primitives/triangles
 		}
-		vkGetAccelerationStructureBuildSizesKHR(ctx.device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+		vkGetAccelerationStructureBuildSizesKHR(ctx.device,
+												host_as_builds ? VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR
+															   : VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
 												&buildAs[idx].build_info, maxPrimCount.data(), &buildAs[idx].size_info);
 
 		// Extra info
 		as_total_size += buildAs[idx].size_info.accelerationStructureSize;
-		max_scratch_size = std::max(max_scratch_size, buildAs[idx].size_info.buildScratchSize);
+		const VkDeviceSize aligned_scratch_size = align_up(buildAs[idx].size_info.buildScratchSize, scratch_alignment);
+		max_scratch_size = std::max(max_scratch_size, aligned_scratch_size);
+		total_scratch_size += aligned_scratch_size;
 		nb_compactions +=
 			has_flag(buildAs[idx].build_info.flags, VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
 	}
 
+	if (host_as_builds) {
+		build_blas_host(buildAs);
+		for (auto& b : buildAs) {
+			blases.emplace_back(b.as);
+		}
+		return;
+	}
+
 	// Allocate the scratch buffers holding the temporary data of the
-	// acceleration structure builder
+	// acceleration structure builder. Builds are packed into the budget and run
+	// concurrently, the largest one always fits
+	const VkDeviceSize scratch_size = std::max(max_scratch_size, std::min(total_scratch_size, blas_scratch_budget));
 	Buffer scratch_buffer;
 	scratch_buffer.create(&ctx, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-						  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE, max_scratch_size);
+						  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE,
+						  scratch_size + scratch_alignment);
 	VkBufferDeviceAddressInfo buffer_info{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr, scratch_buffer.handle};
-	VkDeviceAddress scratchAddress = vkGetBufferDeviceAddress(ctx.device, &buffer_info);
+	// Sub-allocated regions start at aligned offsets of an aligned base
+	VkDeviceAddress scratchAddress = align_up(vkGetBufferDeviceAddress(ctx.device, &buffer_info), scratch_alignment);
 
 	// Allocate a query pool for storing the needed size for every BLAS
 	// compaction.
@@ -828,9 +1051,11 @@ void VulkanBase::build_blas(const std::vector<BlasInput>& input, VkBuildAccelera
 		// Over the limit or last BLAS element
 		if (batchSize >= batchLimit || idx == nb_blas - 1) {
 			CommandBuffer cmdBuf(&ctx, true, 0, QueueType::GFX);
-			cmd_create_blas(cmdBuf.handle, indices, buildAs, scratchAddress, queryPool);
+			cmd_create_blas(cmdBuf.handle, indices, buildAs, scratchAddress, scratch_size, queryPool);
 			cmdBuf.submit();
 			if (queryPool) {
+				// The sizes are only known once the builds have finished, the copies go into a new recording
+				cmdBuf.begin();
 				cmd_compact_blas(cmdBuf.handle, indices, buildAs, queryPool);
 				cmdBuf.submit();
 				// Destroy the non-compacted version
@@ -850,8 +1075,11 @@ void VulkanBase::build_blas(const std::vector<BlasInput>& input, VkBuildAccelera
 		VkDeviceSize compact_size =
 			std::accumulate(buildAs.begin(), buildAs.end(), 0ULL,
 							[](const auto& a, const auto& b) { return a + b.size_info.accelerationStructureSize; });
-		LUMEN_TRACE(" RT BLAS: reducing from: %u to: %u = %u (%2.2f%s smaller) \n", as_total_size, compact_size,
-					as_total_size - compact_size, (as_total_size - compact_size) / float(as_total_size) * 100.f, "%");
+		LUMEN_TRACE("BLAS memory of {} meshes compacted from {:.2f} MB to {:.2f} MB ({:.1f}% smaller)", nb_blas,
+					as_total_size * 1e-6, compact_size * 1e-6,
+					(as_total_size - compact_size) / double(as_total_size) * 100.0);
+	} else {
+		LUMEN_TRACE("BLAS memory of {} meshes: {:.2f} MB, without compaction", nb_blas, as_total_size * 1e-6);
 	}
 
 	// Keeping all the created acceleration structures
@@ -863,6 +1091,128 @@ void VulkanBase::build_blas(const std::vector<BlasInput>& input, VkBuildAccelera
 	scratch_buffer.destroy();
 }
 
+// Drives a deferred host operation to completion from the calling thread and the
+// ThreadPool workers, as many as the operation can use
+static VkResult join_deferred_operation(VkDevice device, VkDeferredOperationKHR op) {
+	auto join = [device, op]() { return vkDeferredOperationJoinKHR(device, op); };
+	// The calling thread joins as well, 0 means no more threads are useful
+	const uint32_t max_concurrency = vkGetDeferredOperationMaxConcurrencyKHR(device, op);
+	const uint32_t num_workers = max_concurrency ? std::min(max_concurrency, std::max(ThreadPool::size(), 1u)) - 1 : 0;
+	std::vector<std::future<VkResult>> futures;
+	for (uint32_t i = 0; i < num_workers; i++) {
+		futures.push_back(ThreadPool::submit(join));
+	}
+	VkResult result = vkGetDeferredOperationResultKHR(device, op);
+	// A thread that runs out of work returns VK_THREAD_IDLE_KHR, the ones still
+	// joined complete the operation. It is joined again only if all of them left early
+	while (result == VK_NOT_READY) {
+		join();
+		for (auto& future : futures) {
+			future.wait();
+		}
+		futures.clear();
+		result = vkGetDeferredOperationResultKHR(device, op);
+	}
+	return result;
+}
+
+void VulkanBase::build_blas_host(std::vector<BuildAccelerationStructure>& buildAs) {
+	const uint32_t nb_blas = (uint32_t)buildAs.size();
+	if (!nb_blas) {
+		return;
+	}
+	// Host commands need the acceleration structures in host visible memory
+	constexpr VkMemoryPropertyFlags host_mem_flags =
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	VkDeferredOperationKHR op;
+	vk::check(vkCreateDeferredOperationKHR(ctx.device, nullptr, &op), "Failed to create deferred operation");
+	// Builds are packed into the scratch budget like on the device, each group is one deferred operation
+	const VkDeviceSize scratch_alignment = ctx.as_props.minAccelerationStructureScratchOffsetAlignment;
+	std::vector<uint8_t> scratch;
+	std::vector<VkAccelerationStructureBuildGeometryInfoKHR> build_infos;
+	std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> range_infos;
+	std::vector<VkDeviceSize> scratch_offsets(nb_blas);
+	VkDeviceSize scratch_offset{0};
+	std::vector<uint32_t> group;
+	auto flush_group = [&]() {
+		if (group.empty()) {
+			return;
+		}
+		// Offsets were assigned while the group was packed, the base is only known now
+		scratch.resize(std::max(scratch.size(), (size_t)scratch_offset));
+		for (auto idx : group) {
+			buildAs[idx].build_info.scratchData.hostAddress = scratch.data() + scratch_offsets[idx];
+			build_infos.push_back(buildAs[idx].build_info);
+			range_infos.push_back(buildAs[idx].range_info);
+		}
+		VkResult result = vkBuildAccelerationStructuresKHR(ctx.device, op, (uint32_t)build_infos.size(),
+														   build_infos.data(), range_infos.data());
+		if (result == VK_OPERATION_DEFERRED_KHR) {
+			result = join_deferred_operation(ctx.device, op);
+		} else if (result == VK_OPERATION_NOT_DEFERRED_KHR) {
+			result = VK_SUCCESS;
+		}
+		vk::check(result, "Host acceleration structure build failed");
+		build_infos.clear();
+		range_infos.clear();
+		group.clear();
+		scratch_offset = 0;
+	};
+	for (uint32_t idx = 0; idx < nb_blas; idx++) {
+		const VkDeviceSize scratch_size = align_up(buildAs[idx].size_info.buildScratchSize, scratch_alignment);
+		if (scratch_offset + scratch_size > blas_scratch_budget) {
+			flush_group();
+		}
+		VkAccelerationStructureCreateInfoKHR create_info{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+		create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		create_info.size = buildAs[idx].size_info.accelerationStructureSize;
+		buildAs[idx].as = create_acceleration(create_info, host_mem_flags);
+		buildAs[idx].build_info.dstAccelerationStructure = buildAs[idx].as.accel;
+		scratch_offsets[idx] = scratch_offset;
+		scratch_offset += scratch_size;
+		group.push_back(idx);
+	}
+	flush_group();
+	vkDestroyDeferredOperationKHR(ctx.device, op, nullptr);
+
+	if (!has_flag(buildAs[0].build_info.flags, VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR)) {
+		return;
+	}
+	std::vector<VkAccelerationStructureKHR> handles(nb_blas);
+	for (uint32_t idx = 0; idx < nb_blas; idx++) {
+		handles[idx] = buildAs[idx].as.accel;
+	}
+	std::vector<VkDeviceSize> compact_sizes(nb_blas);
+	vk::check(vkWriteAccelerationStructuresPropertiesKHR(ctx.device, nb_blas, handles.data(),
+														 VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+														 compact_sizes.size() * sizeof(VkDeviceSize),
+														 compact_sizes.data(), sizeof(VkDeviceSize)),
+			  "Failed to query compacted sizes");
+	VkDeviceSize as_total_size{0};
+	VkDeviceSize compact_size{0};
+	for (uint32_t idx = 0; idx < nb_blas; idx++) {
+		as_total_size += buildAs[idx].size_info.accelerationStructureSize;
+		compact_size += compact_sizes[idx];
+		AccelKHR built = buildAs[idx].as;
+		VkAccelerationStructureCreateInfoKHR create_info{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+		create_info.size = compact_sizes[idx];
+		create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		buildAs[idx].as = create_acceleration(create_info, host_mem_flags);
+		buildAs[idx].size_info.accelerationStructureSize = compact_sizes[idx];
+		VkCopyAccelerationStructureInfoKHR copy_info{VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR};
+		copy_info.src = built.accel;
+		copy_info.dst = buildAs[idx].as.accel;
+		copy_info.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+		vk::check(vkCopyAccelerationStructureKHR(ctx.device, VK_NULL_HANDLE, &copy_info),
+				  "Failed to compact acceleration structure");
+		vkDestroyAccelerationStructureKHR(ctx.device, built.accel, nullptr);
+		built.buffer.destroy();
+	}
+	LUMEN_TRACE("BLAS memory of {} meshes compacted on the host from {:.2f} MB to {:.2f} MB ({:.1f}% smaller)",
+				nb_blas, as_total_size * 1e-6, compact_size * 1e-6,
+				(as_total_size - compact_size) / double(as_total_size) * 100.0);
+}
+
 VkDeviceAddress VulkanBase::get_blas_device_address(uint32_t blas_idx) {
 	assert(size_t(blas_idx) < blases.size());
 	VkAccelerationStructureDeviceAddressInfoKHR addr_info{
@@ -871,13 +1221,237 @@ VkDeviceAddress VulkanBase::get_blas_device_address(uint32_t blas_idx) {
 	return vkGetAccelerationStructureDeviceAddressKHR(ctx.device, &addr_info);
 }
 
+// Serialized acceleration structures start with the driver UUID and the compatibility
+// UUID, followed by the serialized size, the deserialized size and the number of
+// instance handles (always 0 for BLASes)
+static constexpr size_t AS_SERIALIZED_HEADER_SIZE = 2 * VK_UUID_SIZE + 3 * sizeof(uint64_t);
+// Copies to and from memory need 256 byte aligned addresses
+static constexpr VkDeviceSize AS_SERIALIZED_ALIGNMENT = 256;
+static constexpr uint32_t AS_CACHE_MAGIC = 0x53414C4C;	// "LLAS"
+static constexpr uint32_t AS_CACHE_VERSION = 1;
+static const std::string AS_CACHE_DIR = "as_cache/";
+
+struct AccelCacheFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t geometry_hash;
+	uint8_t device_uuid[VK_UUID_SIZE];
+	uint32_t num_blas;
+};
+
+static std::string get_as_cache_path(uint64_t geometry_hash) {
+	return AS_CACHE_DIR + fmt::format("{:016x}.blas", geometry_hash);
+}
+
+static AccelCacheFileHeader make_as_cache_header(VkPhysicalDevice physical_device, uint64_t geometry_hash,
+												 uint32_t num_blas) {
+	VkPhysicalDeviceIDProperties id_props{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES};
+	VkPhysicalDeviceProperties2 prop2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+	prop2.pNext = &id_props;
+	vkGetPhysicalDeviceProperties2(physical_device, &prop2);
+	AccelCacheFileHeader header{};
+	header.magic = AS_CACHE_MAGIC;
+	header.version = AS_CACHE_VERSION;
+	header.geometry_hash = geometry_hash;
+	memcpy(header.device_uuid, id_props.deviceUUID, VK_UUID_SIZE);
+	header.num_blas = num_blas;
+	return header;
+}
+
+bool VulkanBase::load_blas_cache(uint64_t geometry_hash, uint32_t num_blas) {
+	const std::string cache_path = get_as_cache_path(geometry_hash);
+	std::ifstream fin(cache_path, std::ios::binary | std::ios::ate);
+	if (!fin || !num_blas) {
+		return false;
+	}
+	const size_t file_size = (size_t)fin.tellg();
+	fin.seekg(0);
+	const AccelCacheFileHeader expected = make_as_cache_header(ctx.physical_device, geometry_hash, num_blas);
+	AccelCacheFileHeader header{};
+	if (file_size < sizeof(header) || !fin.read((char*)&header, sizeof(header)) || header.magic != expected.magic ||
+		header.version != expected.version || header.geometry_hash != expected.geometry_hash ||
+		memcmp(header.device_uuid, expected.device_uuid, VK_UUID_SIZE) != 0 || header.num_blas != num_blas) {
+		LUMEN_TRACE("Discarding BLAS cache {} from a different device or geometry", cache_path);
+		return false;
+	}
+	std::vector<uint8_t> data(file_size - sizeof(header));
+	if (!fin.read((char*)data.data(), data.size())) {
+		return false;
+	}
+
+	// Every entry is its serialized size followed by the data the driver wrote
+	std::vector<VkDeviceSize> offsets(num_blas);
+	std::vector<VkDeviceSize> accel_sizes(num_blas);
+	VkDeviceSize staging_size{0};
+	size_t pos = 0;
+	for (uint32_t i = 0; i < num_blas; i++) {
+		uint64_t size = 0;
+		if (data.size() - pos < sizeof(size)) {
+			return false;
+		}
+		memcpy(&size, &data[pos], sizeof(size));
+		pos += sizeof(size);
+		if (size < AS_SERIALIZED_HEADER_SIZE || data.size() - pos < size) {
+			LUMEN_WARN("BLAS cache {} is corrupted, rebuilding", cache_path);
+			return false;
+		}
+		// The driver decides whether it can read data written by another driver version
+		VkAccelerationStructureVersionInfoKHR version_info{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR};
+		version_info.pVersionData = &data[pos];
+		VkAccelerationStructureCompatibilityKHR compatibility;
+		vkGetDeviceAccelerationStructureCompatibilityKHR(ctx.device, &version_info, &compatibility);
+		if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) {
+			LUMEN_TRACE("Discarding BLAS cache {} from an incompatible driver", cache_path);
+			return false;
+		}
+		memcpy(&accel_sizes[i], &data[pos + 2 * VK_UUID_SIZE + sizeof(uint64_t)], sizeof(uint64_t));
+		offsets[i] = staging_size;
+		staging_size += align_up(size, AS_SERIALIZED_ALIGNMENT);
+		pos += size;
+	}
+
+	Buffer staging;
+	staging.create(&ctx, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				   VK_SHARING_MODE_EXCLUSIVE, staging_size + AS_SERIALIZED_ALIGNMENT);
+	const VkDeviceAddress base_address = get_device_address(ctx.device, staging.handle);
+	const VkDeviceAddress staging_address = align_up(base_address, AS_SERIALIZED_ALIGNMENT);
+	uint8_t* staging_data = (uint8_t*)staging.data + (staging_address - base_address);
+
+	CommandBuffer cmd(&ctx, true, 0, QueueType::GFX);
+	std::vector<AccelKHR> loaded(num_blas);
+	pos = 0;
+	VkDeviceSize total_size{0};
+	for (uint32_t i = 0; i < num_blas; i++) {
+		uint64_t size;
+		memcpy(&size, &data[pos], sizeof(size));
+		memcpy(staging_data + offsets[i], &data[pos + sizeof(size)], size);
+		pos += sizeof(size) + size;
+
+		VkAccelerationStructureCreateInfoKHR create_info{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+		create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		create_info.size = accel_sizes[i];
+		loaded[i] = create_acceleration(create_info);
+		total_size += accel_sizes[i];
+
+		VkCopyMemoryToAccelerationStructureInfoKHR copy_info{
+			VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR};
+		copy_info.src.deviceAddress = staging_address + offsets[i];
+		copy_info.dst = loaded[i].accel;
+		copy_info.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+		vkCmdCopyMemoryToAccelerationStructureKHR(cmd.handle, &copy_info);
+	}
+	cmd.submit();
+	staging.destroy();
+	for (auto& accel : loaded) {
+		blases.emplace_back(accel);
+	}
+	LUMEN_TRACE("Loaded {} BLASes ({:.2f} MB) from {}", num_blas, total_size * 1e-6, cache_path);
+	return true;
+}
+
+void VulkanBase::save_blas_cache(uint64_t geometry_hash) {
+	const uint32_t num_blas = (uint32_t)blases.size();
+	if (!num_blas) {
+		return;
+	}
+	std::vector<VkAccelerationStructureKHR> handles(num_blas);
+	for (uint32_t i = 0; i < num_blas; i++) {
+		handles[i] = blases[i].accel;
+	}
+	// Query the serialized sizes first
+	VkQueryPool query_pool{VK_NULL_HANDLE};
+	VkQueryPoolCreateInfo qpci{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+	qpci.queryCount = num_blas;
+	qpci.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+	vk::check(vkCreateQueryPool(ctx.device, &qpci, nullptr, &query_pool), "Failed to create query pool");
+	{
+		CommandBuffer cmd(&ctx, true, 0, QueueType::GFX);
+		vkCmdResetQueryPool(cmd.handle, query_pool, 0, num_blas);
+		vkCmdWriteAccelerationStructuresPropertiesKHR(cmd.handle, num_blas, handles.data(),
+													  VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR,
+													  query_pool, 0);
+		cmd.submit();
+	}
+	std::vector<VkDeviceSize> sizes(num_blas);
+	vkGetQueryPoolResults(ctx.device, query_pool, 0, num_blas, sizes.size() * sizeof(VkDeviceSize), sizes.data(),
+						  sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+	vkDestroyQueryPool(ctx.device, query_pool, nullptr);
+
+	std::vector<VkDeviceSize> offsets(num_blas);
+	VkDeviceSize staging_size{0};
+	for (uint32_t i = 0; i < num_blas; i++) {
+		offsets[i] = staging_size;
+		staging_size += align_up(sizes[i], AS_SERIALIZED_ALIGNMENT);
+	}
+	Buffer staging;
+	staging.create(&ctx, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				   VK_SHARING_MODE_EXCLUSIVE, staging_size + AS_SERIALIZED_ALIGNMENT);
+	const VkDeviceAddress base_address = get_device_address(ctx.device, staging.handle);
+	const VkDeviceAddress staging_address = align_up(base_address, AS_SERIALIZED_ALIGNMENT);
+	const uint8_t* staging_data = (const uint8_t*)staging.data + (staging_address - base_address);
+	{
+		CommandBuffer cmd(&ctx, true, 0, QueueType::GFX);
+		for (uint32_t i = 0; i < num_blas; i++) {
+			VkCopyAccelerationStructureToMemoryInfoKHR copy_info{
+				VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR};
+			copy_info.src = handles[i];
+			copy_info.dst.deviceAddress = staging_address + offsets[i];
+			copy_info.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+			vkCmdCopyAccelerationStructureToMemoryKHR(cmd.handle, &copy_info);
+		}
+		// Make the serialized data visible to the host
+		VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(cmd.handle, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+							 VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		cmd.submit();
+	}
+
+	std::error_code ec;
+	std::filesystem::create_directories(AS_CACHE_DIR, ec);
+	const std::string cache_path = get_as_cache_path(geometry_hash);
+	// Written to a temporary first so that readers never observe a partial cache
+	const std::string tmp_path = cache_path + ".tmp";
+	{
+		std::ofstream fout(tmp_path, std::ios::binary | std::ios::trunc);
+		const AccelCacheFileHeader header = make_as_cache_header(ctx.physical_device, geometry_hash, num_blas);
+		fout.write((const char*)&header, sizeof(header));
+		for (uint32_t i = 0; i < num_blas; i++) {
+			const uint64_t size = sizes[i];
+			fout.write((const char*)&size, sizeof(size));
+			fout.write((const char*)staging_data + offsets[i], size);
+		}
+		if (!fout) {
+			LUMEN_WARN("Could not write BLAS cache {}", cache_path);
+			fout.close();
+			std::filesystem::remove(tmp_path, ec);
+			staging.destroy();
+			return;
+		}
+	}
+	staging.destroy();
+	std::filesystem::rename(tmp_path, cache_path, ec);
+	if (ec) {
+		std::filesystem::remove(tmp_path, ec);
+		return;
+	}
+	LUMEN_TRACE("Saved {} BLASes ({:.2f} MB) to {}", num_blas, staging_size * 1e-6, cache_path);
+}
+
 uint32_t VulkanBase::prepare_frame() {
+	if (headless) {
+		vk::check(vkWaitForFences(ctx.device, 1, &in_flight_fences[current_frame], VK_TRUE, UINT64_MAX), "Timeout");
+		vk::check(vkResetCommandBuffer(ctx.command_buffers[current_frame], 0));
+		return (uint32_t)current_frame;
+	}
 	vk::check(vkWaitForFences(ctx.device, 1, &in_flight_fences[current_frame], VK_TRUE, 1000000000), "Timeout");
 
 	uint32_t image_idx;
 	VkResult result = vkAcquireNextImageKHR(ctx.device, ctx.swapchain, UINT64_MAX, image_available_sem[current_frame],
 											VK_NULL_HANDLE, &image_idx);
-	vk::check(vkResetCommandBuffer(ctx.command_buffers[image_idx], 0));
 	if (result == VK_NOT_READY) {
 		return UINT32_MAX;
 	} else if (result == VK_ERROR_OUT_OF_DATE_KHR) {
@@ -890,6 +1464,8 @@ uint32_t VulkanBase::prepare_frame() {
 	if (images_in_flight[image_idx] != VK_NULL_HANDLE) {
 		vkWaitForFences(ctx.device, 1, &images_in_flight[image_idx], VK_TRUE, UINT64_MAX);
 	}
+	// The command buffer holds the whole frame, only reset it once its previous use has finished
+	vk::check(vkResetCommandBuffer(ctx.command_buffers[image_idx], 0));
 
 	EventHandler::begin();
 	if (EventHandler::consume_event(LumenEvent::SHADER_RELOAD)) {
@@ -913,9 +1489,27 @@ uint32_t VulkanBase::prepare_frame() {
 
 VkResult VulkanBase::submit_frame(uint32_t image_idx, bool& resized) {
 	VkSubmitInfo submit_info = vk::submit_info();
-	VkSemaphore wait_semaphores[] = {image_available_sem[current_frame]};
-	VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-	submit_info.waitSemaphoreCount = 1;
+	VkSemaphore wait_semaphores[2];
+	VkPipelineStageFlags wait_stages[2];
+	uint64_t wait_values[2] = {0, 0};
+	uint32_t wait_cnt = 0;
+	if (!headless) {
+		wait_semaphores[wait_cnt] = image_available_sem[current_frame];
+		wait_stages[wait_cnt++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	}
+
+	// Uploads that were submitted without a host wait have to land before the frame reads them
+	const UploadTicket upload_ticket = uploader.frame_wait_ticket();
+	VkTimelineSemaphoreSubmitInfo timeline_info = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+	if (upload_ticket) {
+		wait_semaphores[wait_cnt] = uploader.get_semaphore();
+		wait_stages[wait_cnt] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		wait_values[wait_cnt++] = upload_ticket;
+		timeline_info.waitSemaphoreValueCount = wait_cnt;
+		timeline_info.pWaitSemaphoreValues = wait_values;
+		submit_info.pNext = &timeline_info;
+	}
+	submit_info.waitSemaphoreCount = wait_cnt;
 	submit_info.pWaitSemaphores = wait_semaphores;
 	submit_info.pWaitDstStageMask = wait_stages;
 
@@ -923,13 +1517,20 @@ VkResult VulkanBase::submit_frame(uint32_t image_idx, bool& resized) {
 	submit_info.pCommandBuffers = &ctx.command_buffers[image_idx];
 
 	VkSemaphore signal_semaphores[] = {render_finished_sem[current_frame]};
-	submit_info.signalSemaphoreCount = 1;
+	submit_info.signalSemaphoreCount = headless ? 0 : 1;
 	submit_info.pSignalSemaphores = signal_semaphores;
 
 	vkResetFences(ctx.device, 1, &in_flight_fences[current_frame]);
 
+	// Pipelines can be rebuilt on the thread pool while we render, which uploads their SBTs
+	std::unique_lock<std::mutex> queue_lock(VulkanSyncronization::queue_mutex);
 	vk::check(vkQueueSubmit(ctx.queues[(int)QueueType::GFX], 1, &submit_info, in_flight_fences[current_frame]),
 			  "Failed to submit draw command buffer");
+	if (headless) {
+		queue_lock.unlock();
+		current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+		return VK_SUCCESS;
+	}
 	VkPresentInfoKHR present_info{};
 	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
@@ -943,6 +1544,7 @@ VkResult VulkanBase::submit_frame(uint32_t image_idx, bool& resized) {
 	present_info.pImageIndices = &image_idx;
 
 	VkResult result = vkQueuePresentKHR(ctx.queues[(int)QueueType::GFX], &present_info);
+	queue_lock.unlock();
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || resized) {
 		resized = false;
 		recreate_swap_chain(ctx);
@@ -953,6 +1555,13 @@ VkResult VulkanBase::submit_frame(uint32_t image_idx, bool& resized) {
 	return result;
 }
 
+void VulkanBase::wait_frames_in_flight() {
+	// Fences are only reset right before their frame is submitted
+	vk::check(vkWaitForFences(ctx.device, (uint32_t)in_flight_fences.size(), in_flight_fences.data(), VK_TRUE,
+							  UINT64_MAX),
+			  "Frame wait error");
+}
+
 // Build TLAS from an array of VkAccelerationStructureInstanceKHR
 // - Use motion=true with VkAccelerationStructureMotionInstanceNV
 // - The resulting TLAS will be stored in m_tlas
@@ -962,13 +1571,20 @@ void VulkanBase::build_tlas(std::vector<VkAccelerationStructureInstanceKHR>& ins
 							VkBuildAccelerationStructureFlagsKHR flags, bool update) {
 	// Cannot call buildTlas twice except to update.
 	uint32_t count_instance = static_cast<uint32_t>(instances.size());
-
-	// Command buffer to create the TLAS
+	// TLASes that allow updates keep their instances and scratch memory for update_tlas()
+	const bool keep_buffers = flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
 
 	// Create a buffer holding the actual instance data (matrices++) for use by
 	// the AS builder
 	Buffer instances_buf;  // Buffer of instances containing the matrices and
 						   // BLAS ids
+	Buffer scratch_buffer;
+	if (keep_buffers) {
+		tlas_instance_buffer.destroy();
+		tlas_scratch_buffer.destroy();
+		tlas_instance_buffer = {};
+		tlas_scratch_buffer = {};
+	}
 	instances_buf.create(&ctx,
 						 VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
 							 VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
@@ -986,12 +1602,76 @@ void VulkanBase::build_tlas(std::vector<VkAccelerationStructureInstanceKHR>& ins
 						 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0,
 						 nullptr);
 
-	Buffer scratch_buffer;
 	// Creating the TLAS
-	cmd_create_tlas(cmd.handle, count_instance, scratch_buffer, instBufferAddr, flags, update);
+	cmd_create_tlas(cmd.handle, count_instance, keep_buffers ? tlas_scratch_buffer : scratch_buffer, instBufferAddr,
+					flags, update);
 
 	// Finalizing and destroying temporary data
 	cmd.submit();
-	instances_buf.destroy();
-	scratch_buffer.destroy();
+	if (keep_buffers) {
+		tlas_instance_buffer = instances_buf;
+		tlas_flags = flags;
+		tlas_instance_count = count_instance;
+		tlas_refits = 0;
+	} else {
+		instances_buf.destroy();
+		scratch_buffer.destroy();
+	}
+}
+
+void VulkanBase::update_tlas(const std::vector<TlasInstanceUpdate>& updates,
+							 const std::function<void(VkCommandBuffer)>& record_writes) {
+	if (updates.empty()) {
+		return;
+	}
+	LUMEN_ASSERT(tlas_instance_buffer.handle, "The TLAS was not built with ALLOW_UPDATE");
+	// Frames in flight trace against the TLAS that is about to change
+	wait_frames_in_flight();
+	CommandBuffer cmd(&ctx, true, 0, QueueType::GFX);
+	// Only the changed records are written, runs of consecutive ones in a single update
+	constexpr uint32_t max_run = 65536 / sizeof(VkAccelerationStructureInstanceKHR);
+	std::vector<VkAccelerationStructureInstanceKHR> run;
+	uint32_t run_start = 0;
+	auto flush_run = [&]() {
+		if (!run.empty()) {
+			vkCmdUpdateBuffer(cmd.handle, tlas_instance_buffer.handle,
+							  run_start * sizeof(VkAccelerationStructureInstanceKHR),
+							  run.size() * sizeof(VkAccelerationStructureInstanceKHR), run.data());
+			run.clear();
+		}
+	};
+	for (const auto& update : updates) {
+		LUMEN_ASSERT(update.index < tlas_instance_count, "TLAS instance index out of range");
+		if (run.size() == max_run || run_start + run.size() != update.index) {
+			flush_run();
+			run_start = update.index;
+		}
+		run.push_back(update.instance);
+	}
+	flush_run();
+	VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(cmd.handle, VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0,
+						 nullptr);
+
+	// Refits keep the tree of the last build, which gets looser the further the instances
+	// move, so it is rebuilt in place every so often
+	const bool refit = ++tlas_refits <= tlas_max_refits;
+	if (!refit) {
+		tlas_refits = 0;
+	}
+	cmd_create_tlas(cmd.handle, tlas_instance_count, tlas_scratch_buffer, tlas_instance_buffer.get_device_address(),
+					tlas_flags, refit);
+	if (record_writes) {
+		record_writes(cmd.handle);
+	}
+	barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(cmd.handle,
+						 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	cmd.submit();
+	LUMEN_TRACE("{} {} TLAS instances", refit ? "Refit" : "Rebuilt", updates.size());
 }
@@ -4,6 +4,9 @@
 #include "Buffer.h"
 #include "Framework/Event.h"
 #include "Framework/RenderGraph.h"
+#include "Framework/MemoryAllocator.h"
+#include "Framework/UploadService.h"
+#include "Framework/CommandBufferPool.h"
 
 class RenderGraph;
 
@@ -17,6 +20,12 @@ struct BuildAccelerationStructure {
 };
 const int MAX_FRAMES_IN_FLIGHT = 3;
 
+// An instance record that changed since the TLAS was last built or updated
+struct TlasInstanceUpdate {
+	uint32_t index;
+	VkAccelerationStructureInstanceKHR instance;
+};
+
 class RTAccels {
 	std::vector<AccelKHR> blases;
 	AccelKHR tlas;
@@ -30,6 +39,8 @@ struct VertexLayout {
 
 struct VulkanBase {
 	VulkanBase(bool validation_layers);
+	// Renders without a window, surface or swapchain. Must be called before create_instance()
+	void enable_headless();
 	// Create VKInstance with current extensions
 	void create_instance();
 	void setup_debug_messenger();
@@ -40,17 +51,37 @@ struct VulkanBase {
 	void create_sync_primitives();
 	void create_command_buffers();
 	void create_command_pools();
+	void create_pipeline_cache();
+	void save_pipeline_cache();
 	void cleanup_swapchain();
 	void recreate_swap_chain(VulkanContext&);
 	void add_device_extension(const char* name) { device_extensions.push_back(name); }
-	void build_blas(const std::vector<BlasInput>& input, VkBuildAccelerationStructureFlagsKHR flags);
+	// Compacts the BLASes unless ALLOW_COMPACTION is left out of the flags. With host builds,
+	// the geometry of the inputs must be given by host addresses
+	void build_blas(
+		const std::vector<BlasInput>& input,
+		VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+													 VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
 	void build_tlas(
 		std::vector<VkAccelerationStructureInstanceKHR>& instances,
 		VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
 		bool update = false);
+	// Writes the changed instances of a TLAS built with ALLOW_UPDATE and refits it. The updates
+	// must be sorted by index. Every tlas_max_refits + 1-th update rebuilds the TLAS in place instead.
+	// record_writes records further transfer writes into the same graphics command buffer
+	void update_tlas(const std::vector<TlasInstanceUpdate>& updates,
+					 const std::function<void(VkCommandBuffer)>& record_writes = nullptr);
 	VkDeviceAddress get_blas_device_address(uint32_t blas_idx);
+	// Serialized BLASes on disk, keyed by a hash of the geometry and build flags. Loading
+	// fails unless the file was written for the same geometry on a compatible device
+	bool load_blas_cache(uint64_t geometry_hash, uint32_t num_blas);
+	void save_blas_cache(uint64_t geometry_hash);
+	// Frees the BLASes and the TLAS, for loading another scene
+	void destroy_acceleration_structures();
 	uint32_t prepare_frame();
 	VkResult submit_frame(uint32_t image_idx, bool& resized);
+	// Blocks until every submitted frame has finished, for host access to resources they use
+	void wait_frames_in_flight();
 
 	struct SwapChainSupportDetails {
 		VkSurfaceCapabilitiesKHR capabilities = {};
@@ -81,6 +112,9 @@ struct VulkanBase {
 	std::vector<VkFence> images_in_flight;
 	std::vector<VkQueueFamilyProperties> queue_families;
 	VulkanContext ctx;
+	MemoryAllocator allocator;
+	UploadService uploader;
+	CommandBufferPool cmd_buffer_pool;
 	std::unique_ptr<RenderGraph> rg;
 	VkFormat swapchain_format;
 
@@ -89,6 +123,14 @@ struct VulkanBase {
 	AccelKHR tlas;
 
 	bool enable_validation_layers;
+	bool headless = false;
+	// Builds BLASes on the host, split across the ThreadPool workers. Must be set before
+	// create_logical_device(), which turns it off when the device lacks host commands
+	bool host_as_builds = false;
+	// Scratch memory shared by concurrent BLAS builds, a single build may still exceed it
+	VkDeviceSize blas_scratch_budget = 128'000'000;	 // 128 MB
+	// Refits of the TLAS before it is rebuilt, as refits lose trace performance
+	uint32_t tlas_max_refits = 32;
 	// int width;
 	// int height;
 	// bool fullscreen;
@@ -97,12 +139,15 @@ struct VulkanBase {
 	void cleanup();
 
    private:
-	AccelKHR create_acceleration(VkAccelerationStructureCreateInfoKHR& accel);
+	AccelKHR create_acceleration(VkAccelerationStructureCreateInfoKHR& accel,
+								 VkMemoryPropertyFlags mem_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	void build_blas_host(std::vector<BuildAccelerationStructure>& buildAs);
 	void cmd_compact_blas(VkCommandBuffer cmdBuf, std::vector<uint32_t> indices,
 						  std::vector<BuildAccelerationStructure>& buildAs, VkQueryPool queryPool);
+	// Builds with a combined scratch size up to scratchSize are recorded into one call
 	void cmd_create_blas(VkCommandBuffer cmdBuf, std::vector<uint32_t> indices,
 						 std::vector<BuildAccelerationStructure>& buildAs, VkDeviceAddress scratchAddress,
-						 VkQueryPool queryPool);
+						 VkDeviceSize scratchSize, VkQueryPool queryPool);
 
 	void cmd_create_tlas(VkCommandBuffer cmdBuf,  // Command buffer
 						 uint32_t countInstance,  // number of instances
@@ -111,4 +156,11 @@ struct VulkanBase {
 						 VkBuildAccelerationStructureFlagsKHR flags,  // Build creation flag
 						 bool update								  // Update == animation
 	);
+
+	// Kept by TLASes built with ALLOW_UPDATE
+	Buffer tlas_instance_buffer;
+	Buffer tlas_scratch_buffer;
+	VkBuildAccelerationStructureFlagsKHR tlas_flags = 0;
+	uint32_t tlas_instance_count = 0;
+	uint32_t tlas_refits = 0;
 };
@@ -2,12 +2,17 @@
 #include <volk/volk.h>
 #include <GLFW/glfw3.h>
 struct AccelKHR;
+class MemoryAllocator;
+class UploadService;
+class CommandBufferPool;
 
 // Utils
 struct QueueFamilyIndices {
 	std::optional<uint32_t> gfx_family;
 	std::optional<uint32_t> present_family;
 	std::optional<uint32_t> compute_family;
+	// Transfer-only family if the device has one, otherwise the graphics family
+	std::optional<uint32_t> transfer_family;
 
 	// TODO: Extend to other families
 	bool is_complete() { return (gfx_family.has_value() && present_family.has_value()) && compute_family.has_value(); }
@@ -34,9 +39,12 @@ struct VulkanContext {
 	VkRenderPass default_render_pass;
 	VkPipelineLayout pipeline_layout;
 	VkPipeline gfx_pipeline;
+	// Shared by every pipeline, persisted across runs
+	VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
 	// Swapchain related stuff
 	VkExtent2D swapchain_extent;
 	VkSwapchainKHR swapchain;
+	// Backs the per-swapchain-image command buffers
 	std::vector<VkCommandPool> cmd_pools;
 	std::vector<VkQueue> queues;
 	QueueFamilyIndices indices;
@@ -45,16 +53,24 @@ struct VulkanContext {
 	VkPhysicalDeviceProperties device_properties;
 	VkPhysicalDeviceProperties2 device_properties2;
 	VkPhysicalDeviceMemoryProperties memory_properties;
+	// Backs every Buffer and Texture, owned by VulkanBase
+	MemoryAllocator* allocator = nullptr;
+	// Copies staged data on the transfer queue, owned by VulkanBase
+	UploadService* uploader = nullptr;
+	// Per-thread command pools and fences for CommandBuffer, owned by VulkanBase
+	CommandBufferPool* cmd_buffer_pool = nullptr;
 
 	VkPhysicalDeviceRayTracingPipelinePropertiesKHR rt_props{
 		VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
+	VkPhysicalDeviceAccelerationStructurePropertiesKHR as_props{
+		VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR};
 
 	VkImage depth_img;
 	VkDeviceMemory depth_img_memory;
 	VkImageView depth_img_view;
 };
 
-enum class QueueType { GFX, COMPUTE, PRESENT };
+enum class QueueType { GFX, COMPUTE, PRESENT, TRANSFER };
 
 struct BlasInput {
 	// Data used to build acceleration structure geometry
@@ -7,6 +7,7 @@ class BDPT : public Integrator {
 	virtual void render() override;
 	virtual bool update() override;
 	virtual void destroy() override;
+	virtual bool supports_variance() const override { return true; }
 
    private:
 	PushConstantRay pc_ray{};
@@ -1,47 +1,93 @@
 #include "LumenPCH.h"
 #include "Integrator.h"
+#include "Framework/UploadBatch.h"
 #include <stb_image.h>
 
 void Integrator::init() {
 	VkPhysicalDeviceProperties2 prop2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
 	prop2.pNext = &rt_props;
 	vkGetPhysicalDeviceProperties2(instance->vkb.ctx.physical_device, &prop2);
-	constexpr int VERTEX_BINDING_ID = 0;
 
 	LumenInstance* instance = this->instance;
 	Window* window = instance->window;
 
+	create_camera();
+	if (window) {
+		instance->window->add_mouse_click_callback([this, window](MouseAction button, KeyAction action) {
+			if (updated && window->is_mouse_up(MouseAction::LEFT)) {
+				updated = true;
+			}
+			if (updated && window->is_mouse_down(MouseAction::LEFT)) {
+				updated = true;
+			}
+		});
+		instance->window->add_mouse_move_callback([window, this](double delta_x, double delta_y) {
+			if (window->is_mouse_held(MouseAction::LEFT)) {
+				camera->rotate(0.05f * (float)delta_y, -0.05f * (float)delta_x, 0.0f);
+				// pc_ray.frame_num = -1;
+				updated = true;
+			}
+		});
+	}
+	scene_ubo_buffer.create("Scene UBO", &instance->vkb.ctx,
+							VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+							VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE, sizeof(SceneUBO));
+	update_uniform_buffers();
+	if (!shared_scene_resources) {
+		init_scene_resources();
+	}
+	// Create offscreen image for output
+	TextureSettings settings;
+	settings.usage_flags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+						   VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+						   VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	settings.base_extent = {(uint32_t)instance->width, (uint32_t)instance->height, 1};
+	settings.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	output_tex.create_empty_texture("Color Output", &instance->vkb.ctx, settings, VK_IMAGE_LAYOUT_GENERAL);
+}
+
+void Integrator::create_camera() {
 	if (lumen_scene->config.cam_settings.pos != vec3(0)) {
 		camera = std::unique_ptr<PerspectiveCamera>(new PerspectiveCamera(
-			lumen_scene->config.cam_settings.fov, 0.01f, 1000.0f, (float)instance->width / instance->height,
+			lumen_scene->config.cam_settings.fov, 0.01f, 1000.0f, (float)instance->image_width / instance->image_height,
 			lumen_scene->config.cam_settings.dir, lumen_scene->config.cam_settings.pos));
 	} else {
 		// Assume the camera matrix is given
 		camera = std::unique_ptr<PerspectiveCamera>(
 			new PerspectiveCamera(lumen_scene->config.cam_settings.fov, lumen_scene->config.cam_settings.cam_matrix,
-								  0.01f, 1000.0f, (float)instance->width / instance->height));
+								  0.01f, 1000.0f, (float)instance->image_width / instance->image_height));
 	}
+}
 
-	Camera* cam_ptr = camera.get();
-	instance->window->add_mouse_click_callback([cam_ptr, this, window](MouseAction button, KeyAction action) {
-		if (updated && window->is_mouse_up(MouseAction::LEFT)) {
-			updated = true;
-		}
-		if (updated && window->is_mouse_down(MouseAction::LEFT)) {
-			updated = true;
-		}
-	});
-	instance->window->add_mouse_move_callback([window, cam_ptr, this](double delta_x, double delta_y) {
-		if (window->is_mouse_held(MouseAction::LEFT)) {
-			cam_ptr->rotate(0.05f * (float)delta_y, -0.05f * (float)delta_x, 0.0f);
-			// pc_ray.frame_num = -1;
-			updated = true;
-		}
-	});
+void Integrator::take_scene_resources(Integrator& other) {
+	auto take = [](Buffer& dst, Buffer& src) {
+		dst = src;
+		src = {};
+	};
+	take(vertex_buffer, other.vertex_buffer);
+	take(normal_buffer, other.normal_buffer);
+	take(uv_buffer, other.uv_buffer);
+	take(index_buffer, other.index_buffer);
+	take(materials_buffer, other.materials_buffer);
+	take(prim_lookup_buffer, other.prim_lookup_buffer);
+	take(mesh_lights_buffer, other.mesh_lights_buffer);
+	scene_textures = std::move(other.scene_textures);
+	other.scene_textures.clear();
+	texture_sampler = std::exchange(other.texture_sampler, VK_NULL_HANDLE);
+	lights = std::move(other.lights);
+	other.lights.clear();
+	instance_lights = std::move(other.instance_lights);
+	other.instance_lights.clear();
+	total_light_triangle_cnt = other.total_light_triangle_cnt;
+	total_light_area = other.total_light_area;
+	shared_scene_resources = true;
+}
+
+void Integrator::init_scene_resources() {
+	LumenInstance* instance = this->instance;
 	auto vertex_buf_size = lumen_scene->positions.size() * sizeof(glm::vec3);
 	auto idx_buf_size = lumen_scene->indices.size() * sizeof(uint32_t);
 	std::vector<PrimMeshInfo> prim_lookup;
-	uint32_t idx = 0;
 	for (auto& pm : lumen_scene->prim_meshes) {
 		PrimMeshInfo m_info;
 		m_info.index_offset = pm.first_idx;
@@ -51,12 +97,19 @@ void Integrator::init() {
 		m_info.max_pos = glm::vec4(pm.max_pos, 0);
 		m_info.material_index = pm.material_idx;
 		prim_lookup.emplace_back(m_info);
+	}
+	// Every instance of an emissive mesh is a separate area light
+	instance_lights.assign(lumen_scene->mesh_instances.size(), -1);
+	for (size_t i = 0; i < lumen_scene->mesh_instances.size(); i++) {
+		const auto& mi = lumen_scene->mesh_instances[i];
+		const auto& pm = lumen_scene->prim_meshes[mi.prim_mesh_idx];
 		auto& mef = lumen_scene->materials[pm.material_idx].emissive_factor;
 		if (mef.x > 0 || mef.y > 0 || mef.z > 0) {
+			instance_lights[i] = (int32_t)lights.size();
 			Light light;
-			light.world_matrix = pm.world_matrix;
+			light.world_matrix = mi.world_matrix;
 			light.num_triangles = pm.idx_count / 3;
-			light.prim_mesh_idx = idx;
+			light.prim_mesh_idx = mi.prim_mesh_idx;
 			light.light_flags = LIGHT_AREA;
 			// Is finite
 			light.light_flags |= 1 << 4;
@@ -65,7 +118,6 @@ void Integrator::init() {
 			lights.emplace_back(light);
 			total_light_triangle_cnt += light.num_triangles;
 		}
-		idx++;
 	}
 
 	for (auto& l : lumen_scene->lights) {
@@ -80,43 +132,42 @@ void Integrator::init() {
 		lights.emplace_back(light);
 	}
 
-	scene_ubo_buffer.create("Scene UBO", &instance->vkb.ctx, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-							VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-							VK_SHARING_MODE_EXCLUSIVE, sizeof(SceneUBO));
-	update_uniform_buffers();
-
+	// Geometry goes out first so that the copies overlap with texture decoding, the
+	// acceleration structures only need it to be done before they are built
+	UploadBatch upload(&instance->vkb.ctx);
 	vertex_buffer.create("Vertex Buffer", &instance->vkb.ctx,
 						 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
 							 VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
 							 VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
 						 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE, vertex_buf_size,
-						 lumen_scene->positions.data(), true);
+						 lumen_scene->positions.data(), upload);
 	index_buffer.create("Index Buffer", &instance->vkb.ctx,
 						VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
 							VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
 							VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
 						VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE, idx_buf_size,
-						lumen_scene->indices.data(), true);
+						lumen_scene->indices.data(), upload);
 
 	normal_buffer.create("Normal Buffer", &instance->vkb.ctx,
 						 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
 							 VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 						 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE,
 						 lumen_scene->normals.size() * sizeof(lumen_scene->normals[0]), lumen_scene->normals.data(),
-						 true);
+						 upload);
 	uv_buffer.create("UV Buffer", &instance->vkb.ctx,
 					 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
 						 VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 					 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE,
-					 lumen_scene->texcoords0.size() * sizeof(glm::vec2), lumen_scene->texcoords0.data(), true);
+					 lumen_scene->texcoords0.size() * sizeof(glm::vec2), lumen_scene->texcoords0.data(), upload);
 	materials_buffer.create("Materials Buffer", &instance->vkb.ctx,
 							VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 							VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE,
-							lumen_scene->materials.size() * sizeof(Material), lumen_scene->materials.data(), true);
+							lumen_scene->materials.size() * sizeof(Material), lumen_scene->materials.data(), upload);
 	prim_lookup_buffer.create("Prim Lookup Buffer", &instance->vkb.ctx,
 							  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 							  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE,
-							  prim_lookup.size() * sizeof(PrimMeshInfo), prim_lookup.data(), true);
+							  prim_lookup.size() * sizeof(PrimMeshInfo), prim_lookup.data(), upload);
+	const UploadTicket geometry_ticket = upload.submit_async();
 
 	// Create a sampler for textures
 	VkSamplerCreateInfo sampler_ci = vk::sampler_create_info();
@@ -127,11 +178,14 @@ void Integrator::init() {
 	vk::check(vkCreateSampler(instance->vkb.ctx.device, &sampler_ci, nullptr, &texture_sampler),
 			  "Could not create image sampler");
 
-	auto add_default_texture = [this, instance]() {
+	// Textures are only sampled by the first frame, which waits on them on the GPU
+	UploadBatch texture_upload(&instance->vkb.ctx);
+	auto add_default_texture = [this, instance, &texture_upload]() {
 		std::array<uint8_t, 4> nil = {0, 0, 0, 0};
 		scene_textures.resize(1);
 		auto ci = make_img2d_ci(VkExtent2D{1, 1});
-		scene_textures[0].load_from_data(&instance->vkb.ctx, nil.data(), 4, ci, texture_sampler);
+		scene_textures[0].load_from_data(texture_upload, &instance->vkb.ctx, nil.data(), 4, ci, texture_sampler,
+										 false);
 	};
 
 	if (!lumen_scene->textures.size()) {
@@ -139,46 +193,97 @@ void Integrator::init() {
 	} else {
 		scene_textures.resize(lumen_scene->textures.size());
 		int i = 0;
-		for (const auto& texture_path : lumen_scene->textures) {
+		for (const auto& texture : lumen_scene->textures) {
 			int x, y, n;
-			unsigned char* data = stbi_load(texture_path.c_str(), &x, &y, &n, 4);
+			unsigned char* data = texture.data.empty()
+									  ? stbi_load(texture.path.c_str(), &x, &y, &n, 4)
+									  : stbi_load_from_memory(texture.data.data(), (int)texture.data.size(), &x,
+															  &y, &n, 4);
 
 			auto size = x * y * 4;
 			auto img_dims = VkExtent2D{(uint32_t)x, (uint32_t)y};
 			auto ci = make_img2d_ci(img_dims, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT, false);
-			scene_textures[i].load_from_data(&instance->vkb.ctx, data, size, ci, texture_sampler, false);
+			scene_textures[i].load_from_data(texture_upload, &instance->vkb.ctx, data, size, ci, texture_sampler,
+											 false);
 			stbi_image_free(data);
 			i++;
 		}
 	}
+	instance->vkb.ctx.uploader->wait_on_frame(texture_upload.submit_async());
+	// The acceleration structures are built from the uploaded geometry
+	instance->vkb.ctx.uploader->wait(geometry_ticket);
 	// Create BLAS and TLAS
 	create_blas();
 	create_tlas();
-	// Create offscreen image for output
-	TextureSettings settings;
-	settings.usage_flags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
-						   VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-						   VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-	settings.base_extent = {(uint32_t)instance->width, (uint32_t)instance->height, 1};
-	settings.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-	output_tex.create_empty_texture("Color Output", &instance->vkb.ctx, settings, VK_IMAGE_LAYOUT_GENERAL);
 }
 
 bool Integrator::gui() {
 	ImGui::Text("Path length: %d", lumen_scene->config.path_length);
 	ImGui::Text("Integrator: %s", lumen_scene->config.integrator_name.c_str());
+	// Moving an instance refits the TLAS
+	if (!lumen_scene->mesh_instances.empty()) {
+		ImGui::SliderInt("Instance", &gui_instance_idx, 0, (int)lumen_scene->mesh_instances.size() - 1);
+		glm::mat4 world_matrix = lumen_scene->mesh_instances[gui_instance_idx].world_matrix;
+		if (ImGui::DragFloat3("Instance position", glm::value_ptr(world_matrix[3]), 0.01f)) {
+			set_instance_transform(gui_instance_idx, world_matrix);
+		}
+	}
 	return false;
 }
 
+// Identifies everything the BLASes are built from, for the BLAS disk cache
+static uint64_t hash_blas_inputs(const LumenScene& scene, VkBuildAccelerationStructureFlagsKHR flags) {
+	std::vector<glm::uvec4> ranges;
+	ranges.reserve(scene.prim_meshes.size());
+	for (const auto& prim_mesh : scene.prim_meshes) {
+		ranges.emplace_back(prim_mesh.vtx_offset, prim_mesh.first_idx, prim_mesh.idx_count, prim_mesh.vtx_count);
+	}
+	const uint64_t hashes[] = {
+		robin_hood::hash_bytes(scene.positions.data(), scene.positions.size() * sizeof(glm::vec3)),
+		robin_hood::hash_bytes(scene.indices.data(), scene.indices.size() * sizeof(uint32_t)),
+		robin_hood::hash_bytes(ranges.data(), ranges.size() * sizeof(glm::uvec4)),
+		(uint64_t)flags,
+	};
+	return robin_hood::hash_bytes(hashes, sizeof(hashes));
+}
+
 void Integrator::create_blas() {
+	constexpr VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+														   VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+	// Unchanged geometry is deserialized instead of being built again
+	const uint64_t geometry_hash = hash_blas_inputs(*lumen_scene, flags);
+	if (instance->vkb.load_blas_cache(geometry_hash, (uint32_t)lumen_scene->prim_meshes.size())) {
+		return;
+	}
 	std::vector<BlasInput> blas_inputs;
 	auto vertex_address = get_device_address(instance->vkb.ctx.device, vertex_buffer.handle);
 	auto idx_address = get_device_address(instance->vkb.ctx.device, index_buffer.handle);
 	for (auto& prim_mesh : lumen_scene->prim_meshes) {
 		BlasInput geo = to_vk_geometry(prim_mesh, vertex_address, idx_address);
+		if (instance->vkb.host_as_builds) {
+			// Host builds read the geometry from the scene instead of the device buffers
+			auto& triangles = geo.as_geom[0].geometry.triangles;
+			triangles.vertexData.hostAddress = lumen_scene->positions.data();
+			triangles.indexData.hostAddress = lumen_scene->indices.data();
+		}
 		blas_inputs.push_back({geo});
 	}
-	instance->vkb.build_blas(blas_inputs, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+	instance->vkb.build_blas(blas_inputs, flags);
+	instance->vkb.save_blas_cache(geometry_hash);
+}
+
+static VkAccelerationStructureInstanceKHR make_tlas_instance(VulkanBase& vkb, const LumenScene& scene,
+															  const LumenMeshInstance& mi) {
+	// Instances of the same prim mesh reference a single BLAS
+	const auto& pm = scene.prim_meshes[mi.prim_mesh_idx];
+	VkAccelerationStructureInstanceKHR ray_inst{};
+	ray_inst.transform = to_vk_matrix(mi.world_matrix);
+	ray_inst.instanceCustomIndex = pm.prim_idx;
+	ray_inst.accelerationStructureReference = vkb.get_blas_device_address(pm.prim_idx);
+	ray_inst.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+	ray_inst.mask = 0xFF;
+	ray_inst.instanceShaderBindingTableRecordOffset = 0;  // We will use the same hit group for all objects
+	return ray_inst;
 }
 
 void Integrator::create_tlas() {
@@ -187,30 +292,22 @@ void Integrator::create_tlas() {
 	// int light_triangle_cnt = 0;
 	const auto& indices = lumen_scene->indices;
 	const auto& vertices = lumen_scene->positions;
-	for (const auto& pm : lumen_scene->prim_meshes) {
-		VkAccelerationStructureInstanceKHR ray_inst{};
-		ray_inst.transform = to_vk_matrix(pm.world_matrix);
-		ray_inst.instanceCustomIndex = pm.prim_idx;
-		ray_inst.accelerationStructureReference = instance->vkb.get_blas_device_address(pm.prim_idx);
-		ray_inst.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-		ray_inst.mask = 0xFF;
-		ray_inst.instanceShaderBindingTableRecordOffset = 0;  // We will use the same hit group for all objects
-		tlas.emplace_back(ray_inst);
+	for (const auto& mi : lumen_scene->mesh_instances) {
+		tlas.emplace_back(make_tlas_instance(instance->vkb, *lumen_scene, mi));
 	}
 
 	for (auto& l : lights) {
 		if (l.light_flags == LIGHT_AREA) {
 			const auto& pm = lumen_scene->prim_meshes[l.prim_mesh_idx];
-			l.world_matrix = pm.world_matrix;
 			auto& idx_base_offset = pm.first_idx;
 			auto& vtx_offset = pm.vtx_offset;
 			for (uint32_t i = 0; i < l.num_triangles; i++) {
 				auto idx_offset = idx_base_offset + 3 * i;
 				glm::ivec3 ind = {indices[idx_offset], indices[idx_offset + 1], indices[idx_offset + 2]};
 				ind += glm::vec3{vtx_offset, vtx_offset, vtx_offset};
-				const vec3 v0 = pm.world_matrix * glm::vec4(vertices[ind.x], 1.0);
-				const vec3 v1 = pm.world_matrix * glm::vec4(vertices[ind.y], 1.0);
-				const vec3 v2 = pm.world_matrix * glm::vec4(vertices[ind.z], 1.0);
+				const vec3 v0 = l.world_matrix * glm::vec4(vertices[ind.x], 1.0);
+				const vec3 v1 = l.world_matrix * glm::vec4(vertices[ind.y], 1.0);
+				const vec3 v2 = l.world_matrix * glm::vec4(vertices[ind.z], 1.0);
 				float area = 0.5f * glm::length(glm::cross(v1 - v0, v2 - v0));
 				total_light_triangle_area += area;
 			}
@@ -224,10 +321,47 @@ void Integrator::create_tlas() {
 
 	total_light_area += total_light_triangle_area;
 
-	instance->vkb.build_tlas(tlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+	// Allows the instance transforms to be updated with refits
+	instance->vkb.build_tlas(tlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+									   VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
+}
+
+void Integrator::set_instance_transform(uint32_t instance_idx, const glm::mat4& world_matrix) {
+	lumen_scene->mesh_instances[instance_idx].world_matrix = world_matrix;
+	auto it = std::lower_bound(moved_instances.begin(), moved_instances.end(), instance_idx);
+	if (it == moved_instances.end() || *it != instance_idx) {
+		moved_instances.insert(it, instance_idx);
+	}
+	updated = true;
+}
+
+void Integrator::update_instances() {
+	std::vector<TlasInstanceUpdate> tlas_updates;
+	tlas_updates.reserve(moved_instances.size());
+	for (uint32_t idx : moved_instances) {
+		const auto& mi = lumen_scene->mesh_instances[idx];
+		tlas_updates.push_back({idx, make_tlas_instance(instance->vkb, *lumen_scene, mi)});
+	}
+	// The light records are written on the graphics queue that owns the buffer, in
+	// the same submission as the TLAS update. It waits for the frames in flight,
+	// which also read the lights
+	auto write_lights = [this](VkCommandBuffer cmd) {
+		for (uint32_t idx : moved_instances) {
+			const int32_t light_idx = instance_lights[idx];
+			if (light_idx < 0) {
+				continue;
+			}
+			lights[light_idx].world_matrix = lumen_scene->mesh_instances[idx].world_matrix;
+			vkCmdUpdateBuffer(cmd, mesh_lights_buffer.handle, light_idx * sizeof(Light), sizeof(Light),
+							  &lights[light_idx]);
+		}
+	};
+	instance->vkb.update_tlas(tlas_updates, write_lights);
+	moved_instances.clear();
 }
 
 void Integrator::update_uniform_buffers() {
+	const SceneUBO prev_ubo = scene_ubo;
 	camera->update_view_matrix();
 	scene_ubo.view = camera->view;
 	scene_ubo.projection = camera->projection;
@@ -236,14 +370,37 @@ void Integrator::update_uniform_buffers() {
 	scene_ubo.inv_projection = glm::inverse(camera->projection);
 	scene_ubo.model = glm::mat4(1.0);
 	scene_ubo.light_pos = glm::vec4(3.0f, 2.5f, 1.0f, 1.0f);
-	memcpy(scene_ubo_buffer.data, &scene_ubo, sizeof(scene_ubo));
+	// Frames in flight read the buffer, so it is written on the GPU by the next submission
+	// and only when the camera changed
+	if (memcmp(&prev_ubo, &scene_ubo, sizeof(scene_ubo)) != 0) {
+		scene_ubo_dirty = true;
+	}
+}
+
+void Integrator::record_scene_ubo(VkCommandBuffer cmd) {
+	if (!scene_ubo_dirty) {
+		return;
+	}
+	scene_ubo_dirty = false;
+	// Earlier submissions may still be reading the previous contents
+	VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+						 nullptr, 0, nullptr);
+	vkCmdUpdateBuffer(cmd, scene_ubo_buffer.handle, 0, sizeof(SceneUBO), &scene_ubo);
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0,
+						 nullptr, 0, nullptr);
 }
 
 bool Integrator::update() {
 	glm::vec3 translation{};
 	float trans_speed = 0.01f;
 	glm::vec3 front;
-	if (instance->window->is_key_held(KeyInput::KEY_LEFT_SHIFT)) {
+	// Headless renders have no window to take input from
+	auto key_held = [this](KeyInput key) { return instance->window && instance->window->is_key_held(key); };
+	if (key_held(KeyInput::KEY_LEFT_SHIFT)) {
 		trans_speed *= 4;
 	}
 
@@ -251,35 +408,38 @@ bool Integrator::update() {
 	front.y = sin(glm::radians(camera->rotation.x));
 	front.z = cos(glm::radians(camera->rotation.x)) * cos(glm::radians(camera->rotation.y));
 	front = glm::normalize(-front);
-	if (instance->window->is_key_held(KeyInput::KEY_W)) {
+	if (key_held(KeyInput::KEY_W)) {
 		camera->position += front * trans_speed;
 		updated = true;
 	}
-	if (instance->window->is_key_held(KeyInput::KEY_A)) {
+	if (key_held(KeyInput::KEY_A)) {
 		camera->position -= glm::normalize(glm::cross(front, glm::vec3(0.0f, 1.0f, 0.0f))) * trans_speed;
 		updated = true;
 	}
-	if (instance->window->is_key_held(KeyInput::KEY_S)) {
+	if (key_held(KeyInput::KEY_S)) {
 		camera->position -= front * trans_speed;
 		updated = true;
 	}
-	if (instance->window->is_key_held(KeyInput::KEY_D)) {
+	if (key_held(KeyInput::KEY_D)) {
 		camera->position += glm::normalize(glm::cross(front, glm::vec3(0.0f, 1.0f, 0.0f))) * trans_speed;
 		updated = true;
 	}
-	if (instance->window->is_key_held(KeyInput::SPACE) || instance->window->is_key_held(KeyInput::KEY_E)) {
+	if (key_held(KeyInput::SPACE) || key_held(KeyInput::KEY_E)) {
 		// Right
 		auto right = glm::normalize(glm::cross(front, glm::vec3(0.0f, 1.0f, 0.0f)));
 		auto up = glm::cross(right, front);
 		camera->position += up * trans_speed;
 		updated = true;
 	}
-	if (instance->window->is_key_held(KeyInput::KEY_LEFT_CONTROL) || instance->window->is_key_held(KeyInput::KEY_Q)) {
+	if (key_held(KeyInput::KEY_LEFT_CONTROL) || key_held(KeyInput::KEY_Q)) {
 		auto right = glm::normalize(glm::cross(front, glm::vec3(0.0f, 1.0f, 0.0f)));
 		auto up = glm::cross(right, front);
 		camera->position -= up * trans_speed;
 		updated = true;
 	}
+	if (!moved_instances.empty()) {
+		update_instances();
+	}
 	bool result = false;
 	if (updated) {
 		result = true;
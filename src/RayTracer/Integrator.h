@@ -20,6 +20,20 @@ class Integrator {
 	virtual bool gui();
 	virtual bool update();
 	virtual void destroy();
+	// Whether output_tex is an equal weight running mean of independent frames,
+	// which the per pixel variance of offline renders is recovered from
+	virtual bool supports_variance() const { return false; }
+	// Writes the scene UBO if the camera changed since the last call. Has to be recorded
+	// before the passes of every submission that reads the UBO
+	void record_scene_ubo(VkCommandBuffer cmd);
+	// Creates the camera from the scene's camera settings
+	void create_camera();
+	// Takes over the geometry, textures and lights of an integrator of the same scene,
+	// so that init() neither uploads them nor builds the acceleration structures again
+	void take_scene_resources(Integrator& other);
+	// Moves a mesh instance, the TLAS and the instance's area light follow on the next update().
+	// The light areas are not recomputed, so emissive instances should only move rigidly
+	void set_instance_transform(uint32_t instance_idx, const glm::mat4& world_matrix);
 	Texture2D output_tex;
 	std::unique_ptr<Camera> camera = nullptr;
 	bool updated = false;
@@ -28,6 +42,8 @@ class Integrator {
    protected:
 	virtual void update_uniform_buffers();
 	SceneUBO scene_ubo{};
+	// Set when scene_ubo differs from the buffer contents
+	bool scene_ubo_dirty = false;
 	Buffer vertex_buffer;
 	Buffer normal_buffer;
 	Buffer uv_buffer;
@@ -45,8 +61,16 @@ class Integrator {
 	uint32_t total_light_triangle_cnt = 0;
 	float total_light_area = 0;
 	LumenScene* lumen_scene;
+	bool shared_scene_resources = false;
+	// Index of the area light of every mesh instance, -1 for the ones that do not emit
+	std::vector<int32_t> instance_lights;
+	// Sorted mesh instances whose transform changed since the last update()
+	std::vector<uint32_t> moved_instances;
 
    private:
+	void init_scene_resources();
 	void create_blas();
 	void create_tlas();
+	void update_instances();
+	int gui_instance_idx = 0;
 };
@@ -212,6 +212,7 @@ void PSSMLT::render() {
 		scene_desc_buffer,
 	};
 	CommandBuffer cmd(&instance->vkb.ctx, /*start*/ true, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	record_scene_ubo(cmd.handle);
 	// Start bootstrap sampling
 	instance->vkb.rg
 		->add_rt("PSSMLT - Bootstrap Sampling", {.shaders = {{"src/shaders/integrators/pssmlt/pssmlt_seed.rgen"},
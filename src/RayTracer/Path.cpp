@@ -20,7 +20,6 @@ void Path::init() {
 }
 
 void Path::render() {
-	CommandBuffer cmd(&instance->vkb.ctx, /*start*/ true, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 	pc_ray.light_pos = scene_ubo.light_pos;
 	pc_ray.light_type = 0;
 	pc_ray.light_intensity = 10;
@@ -49,7 +48,6 @@ void Path::render() {
 		.bind_texture_array(scene_textures)
 		//.write(output_tex) // Needed if the automatic shader inference is disabled
 		.bind_tlas(instance->vkb.tlas);
-	instance->vkb.rg->run_and_submit(cmd);
 }
 
 bool Path::update() {
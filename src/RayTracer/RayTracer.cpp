@@ -8,6 +8,8 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "RayTracer.h"
+#include "Framework/ShaderBundle.h"
+#include <json.hpp>
 
 RayTracer* RayTracer::instance = nullptr;
 bool load_exr = false;
@@ -25,8 +27,22 @@ RayTracer::RayTracer(int width, int height, bool debug, int argc, char* argv[])
 void RayTracer::init(Window* window) {
 	srand((uint32_t)time(NULL));
 	this->window = window;
-	vkb.ctx.window_ptr = window->get_window_ptr();
-	glfwSetFramebufferSizeCallback(vkb.ctx.window_ptr, fb_resize_callback);
+	// Headless when there is no window: no surface, swapchain or UI
+	if (window) {
+		vkb.ctx.window_ptr = window->get_window_ptr();
+		glfwSetFramebufferSizeCallback(vkb.ctx.window_ptr, fb_resize_callback);
+	} else {
+		vkb.enable_headless();
+		if (offline_width && offline_height) {
+			width = image_width = offline_width;
+			height = image_height = offline_height;
+		}
+		// Per pixel buffers are sized from width x height, so tiles bound the memory of large images
+		if (tile_size) {
+			width = std::min(width, tile_size);
+			height = std::min(height, tile_size);
+		}
+	}
 	// Init with ray tracing extensions
 	vkb.add_device_extension(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME);
 	vkb.add_device_extension(VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME);
@@ -41,25 +57,56 @@ void RayTracer::init(Window* window) {
 	if (vkb.enable_validation_layers) {
 		vkb.setup_debug_messenger();
 	}
-	vkb.create_surface();
+	if (window) {
+		vkb.create_surface();
+	}
 	vkb.pick_physical_device();
 	vkb.create_logical_device();
-	vkb.create_swapchain();
+	if (window) {
+		vkb.create_swapchain();
+	}
 	vkb.create_command_pools();
 	vkb.create_command_buffers();
 	vkb.create_sync_primitives();
+	vkb.create_pipeline_cache();
 	initialized = true;
 
-	scene.load_scene(scene_name);
-
 	// Enable shader reflections for the render graph
 	vkb.rg->settings.shader_inference = true;
 	// Disable event based synchronization
 	// Currently the event API that comes with Vulkan 1.3 is buggy on NVIDIA drivers
 	// so this is turned off and pipeline barriers are used instead
 	vkb.rg->settings.use_events = false;
+	load_scene();
+	create_integrator();
+	integrator->init();
+	init_resources();
+	if (window) {
+		init_imgui();
+	}
+	printf("Memory usage %f MB\n", get_memory_usage(vk_ctx.physical_device) * 1e-6);
+}
+
+void RayTracer::update() {
+	if (instance->window->is_key_down(KeyInput::KEY_F10)) {
+		write_exr = true;
+	}
+	float frame_time = draw_frame();
+	cpu_avg_time = (1.0f - 1.0f / (cnt)) * cpu_avg_time + frame_time / (float)cnt;
+	cpu_avg_time = 0.95f * cpu_avg_time + 0.05f * frame_time;
 
+	integrator->update();
+}
+
+void RayTracer::load_scene() {
+	scene = LumenScene();
+	scene.load_scene(scene_name);
+	scene_config = scene.config;
+	// Compile only the BSDFs the scene's materials use into the shaders
+	vkb.rg->settings.shader_defines = scene.get_bsdf_defines();
+}
 
+void RayTracer::create_integrator() {
 	switch (scene.config.integrator_type) {
 		case IntegratorType::Path:
 			integrator = std::make_unique<Path>(this, &scene);
@@ -94,75 +141,105 @@ void RayTracer::init(Window* window) {
 		default:
 			break;
 	}
-	integrator->init();
-	init_resources();
-	init_imgui();
-	printf("Memory usage %f MB\n", get_memory_usage(vk_ctx.physical_device) * 1e-6);
-}
-
-void RayTracer::update() {
-	if (instance->window->is_key_down(KeyInput::KEY_F10)) {
-		write_exr = true;
-	}
-	float frame_time = draw_frame();
-	cpu_avg_time = (1.0f - 1.0f / (cnt)) * cpu_avg_time + frame_time / (float)cnt;
-	cpu_avg_time = 0.95f * cpu_avg_time + 0.05f * frame_time;
-
-	integrator->update();
+	integrator_type = scene.config.integrator_type;
 }
 
 void RayTracer::render(uint32_t i) {
-	// Render image
+	// Render image, the integrator's passes are recorded into the frame's command buffer
 	integrator->render();
 	auto cmdbuf = vkb.ctx.command_buffers[i];
 	VkCommandBufferBeginInfo begin_info = vk::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 	vk::check(vkBeginCommandBuffer(cmdbuf, &begin_info));
+	// The render graph only synchronizes passes within a frame. Accumulation and temporal
+	// reuse read what the previous frame wrote, so order against everything submitted before
+	VkMemoryBarrier2 frame_barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+	frame_barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+	frame_barrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
+	frame_barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+	frame_barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+	VkDependencyInfo frame_dependency = {VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+	frame_dependency.memoryBarrierCount = 1;
+	frame_dependency.pMemoryBarriers = &frame_barrier;
+	vkCmdPipelineBarrier2(cmdbuf, &frame_dependency);
+	integrator->record_scene_ubo(cmdbuf);
 	pc_post_settings.enable_tonemapping = settings.enable_tonemapping;
-	instance->vkb.rg
-		->add_gfx("Post FX", {.width = instance->width,
-							  .height = instance->height,
-							  .clear_color = {0.25f, 0.25f, 0.25f, 1.0f},
-							  .clear_depth_stencil = {1.0f, 0},
-							  .shaders = {{"src/shaders/post.vert"}, {"src/shaders/post.frag"}},
-							  .cull_mode = VK_CULL_MODE_NONE,
-							  .color_outputs = {&vkb.swapchain_images[i]},
-							  .pass_func =
-								  [](VkCommandBuffer cmd, const RenderPass& render_pass) {
-									  vkCmdDraw(cmd, 3, 1, 0, 0);
-									  ImGui::Render();
-									  ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
-								  }})
-		.push_constants(&pc_post_settings)
-		//.read(integrator->output_tex) // Needed if shader inference is off
-		.bind(integrator->output_tex, integrator->texture_sampler);
+	if (!vkb.headless) {
+		instance->vkb.rg
+			->add_gfx("Post FX", {.width = instance->width,
+								  .height = instance->height,
+								  .clear_color = {0.25f, 0.25f, 0.25f, 1.0f},
+								  .clear_depth_stencil = {1.0f, 0},
+								  .shaders = {{"src/shaders/post.vert"}, {"src/shaders/post.frag"}},
+								  .cull_mode = VK_CULL_MODE_NONE,
+								  .color_outputs = {&vkb.swapchain_images[i]},
+								  .pass_func =
+									  [](VkCommandBuffer cmd, const RenderPass& render_pass) {
+										  vkCmdDraw(cmd, 3, 1, 0, 0);
+										  ImGui::Render();
+										  ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+									  }})
+			.push_constants(&pc_post_settings)
+			//.read(integrator->output_tex) // Needed if shader inference is off
+			.bind(integrator->output_tex, integrator->texture_sampler);
+	}
 
 	if (write_exr) {
 		instance->vkb.rg->current_pass().copy(integrator->output_tex, output_img_buffer_cpu);
 	}
-	if (calc_rmse && has_gt) {
-		auto op_reduce = [&](const std::string& op_name, const std::string& op_shader_name,
-							 const std::string& reduce_name, const std::string& reduce_shader_name) {
-			uint32_t num_wgs = uint32_t((instance->width * instance->height + 1023) / 1024);
-			instance->vkb.rg->add_compute(op_name, {.shader = Shader(op_shader_name), .dims = {num_wgs, 1, 1}})
-				.push_constants(&post_pc)
-				.bind(post_desc_buffer)
-				.zero({residual_buffer, counter_buffer});
-			while (num_wgs != 1) {
+	// Skipped passes are still added, so that the graph stays the same between frames
+	auto op_reduce = [&](const std::string& op_name, const std::string& op_shader_name,
+						 const std::string& reduce_name, const std::string& reduce_shader_name, bool execute) {
+		uint32_t num_wgs = uint32_t((instance->width * instance->height + 1023) / 1024);
+		auto& op_pass = instance->vkb.rg
+							->add_compute(op_name, {.shader = Shader(op_shader_name), .dims = {num_wgs, 1, 1}})
+							.push_constants(&post_pc)
+							.bind(post_desc_buffer)
+							.zero(residual_buffer, execute)
+							.zero(counter_buffer, execute);
+		if (!execute) {
+			op_pass.skip_execution();
+		}
+		while (num_wgs != 1) {
+			auto& reduce_pass =
 				instance->vkb.rg
 					->add_compute(reduce_name, {.shader = Shader(reduce_shader_name), .dims = {num_wgs, 1, 1}})
 					.push_constants(&post_pc)
 					.bind(post_desc_buffer);
-				num_wgs = (num_wgs + 1023) / 1024;
+			if (!execute) {
+				reduce_pass.skip_execution();
 			}
-		};
+			num_wgs = (num_wgs + 1023) / 1024;
+		}
+	};
+	if (calc_rmse && has_gt) {
 		instance->vkb.rg->current_pass().copy(integrator->output_tex, output_img_buffer);
 		// Calculate RMSE
 		op_reduce("OpReduce: RMSE", "src/shaders/rmse/calc_rmse.comp", "OpReduce: Reduce RMSE",
-				  "src/shaders/rmse/reduce_rmse.comp");
+				  "src/shaders/rmse/reduce_rmse.comp", true);
 		instance->vkb.rg
 			->add_compute("Calculate RMSE", {.shader = Shader("src/shaders/rmse/output_rmse.comp"), .dims = {1, 1, 1}})
 			.push_constants(&post_pc)
 			.bind(post_desc_buffer);
+	} else if (track_variance) {
+		// Every frame goes into the per pixel variance, the relative error is only
+		// reduced on the frames it is read back
+		instance->vkb.rg
+			->add_compute("Update Variance", {.shader = Shader("src/shaders/variance/update_variance.comp"),
+											  .dims = {(uint32_t)(instance->width + 31) / 32,
+													   (uint32_t)(instance->height + 31) / 32, 1}})
+			.push_constants(&post_pc)
+			.bind({integrator->output_tex, post_desc_buffer});
+		op_reduce("OpReduce: Relative Error", "src/shaders/variance/calc_error.comp",
+				  "OpReduce: Reduce Relative Error", "src/shaders/rmse/reduce_rmse.comp", check_error);
+		auto& output_pass =
+			instance->vkb.rg
+				->add_compute("Output Relative Error",
+							  {.shader = Shader("src/shaders/variance/output_error.comp"), .dims = {1, 1, 1}})
+				.push_constants(&post_pc)
+				.bind(post_desc_buffer);
+		if (!check_error) {
+			output_pass.skip_execution();
+		}
 	}
 
 	vkb.rg->run(cmdbuf);
@@ -194,10 +271,7 @@ float RayTracer::draw_frame() {
 		ImGui::DragFloat4("", glm::value_ptr(integrator->camera->camera[3]), 0.05f);
 	}
 	if (ImGui::Button("Reload shaders")) {
-		// TODO
-		vkb.rg->reload_shaders = true;
-		vkb.rg->shader_cache.clear();
-		updated |= true;
+		vkb.rg->request_shader_reload();
 	}
 
 	if (updated || gui_updated) {
@@ -219,18 +293,25 @@ float RayTracer::draw_frame() {
 	render(image_idx);
 	vkb.submit_frame(image_idx, resized);
 	vkb.rg->reset(vkb.ctx.command_buffers[image_idx]);
+	if (vkb.rg->shaders_reloaded) {
+		vkb.rg->shaders_reloaded = false;
+		integrator->updated = true;
+	}
 
 	auto now = clock();
 	auto diff = ((float)now - start);
 
 	if (write_exr) {
 		write_exr = false;
+		// The readback is part of the frame that was just submitted
+		vkb.wait_frames_in_flight();
 		save_exr((float*)output_img_buffer_cpu.data, instance->width, instance->height, "out.exr");
 	}
 	bool time_limit = (abs(diff / CLOCKS_PER_SEC - 5)) < 0.1;
 	calc_rmse = time_limit;
 
 	if (calc_rmse && has_gt) {
+		vkb.wait_frames_in_flight();
 		float rmse = *(float*)rmse_val_buffer.data;
 		LUMEN_TRACE("RMSE {}", rmse * 1e6);
 		start = now;
@@ -315,6 +396,15 @@ void RayTracer::init_resources() {
 							   VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 						   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 						   VK_SHARING_MODE_EXCLUSIVE, sizeof(float));
+	variance_buffer.create("Variance", &instance->vkb.ctx,
+						   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+						   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE,
+						   instance->width * instance->height * 2 * 4);
+
+	rel_error_buffer.create("Relative Error", &instance->vkb.ctx,
+							VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+							VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+							VK_SHARING_MODE_EXCLUSIVE, sizeof(float));
 	if (load_exr) {
 		// Load the ground truth image
 		const char* img_name = "out.exr";
@@ -355,27 +445,329 @@ void RayTracer::init_resources() {
 	desc.residual_addr = residual_buffer.get_device_address();
 	desc.counter_addr = counter_buffer.get_device_address();
 	desc.rmse_val_addr = rmse_val_buffer.get_device_address();
+	desc.variance_addr = variance_buffer.get_device_address();
+	desc.rel_error_addr = rel_error_buffer.get_device_address();
 	post_desc_buffer.create(
 		"Post Desc", &instance->vkb.ctx, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_SHARING_MODE_EXCLUSIVE, sizeof(PostDesc), &desc, true);
 	post_pc.size = instance->width * instance->height;
+	post_pc.frame_num = 0;
+	register_post_buffers();
+}
+
+void RayTracer::register_post_buffers() {
+	PostDesc desc;
 	REGISTER_BUFFER_WITH_ADDRESS(PostDesc, desc, out_img_addr, &output_img_buffer, instance->vkb.rg);
 	REGISTER_BUFFER_WITH_ADDRESS(PostDesc, desc, residual_addr, &residual_buffer, instance->vkb.rg);
 	REGISTER_BUFFER_WITH_ADDRESS(PostDesc, desc, counter_addr, &counter_buffer, instance->vkb.rg);
 	REGISTER_BUFFER_WITH_ADDRESS(PostDesc, desc, rmse_val_addr, &rmse_val_buffer, instance->vkb.rg);
+	REGISTER_BUFFER_WITH_ADDRESS(PostDesc, desc, variance_addr, &variance_buffer, instance->vkb.rg);
+	REGISTER_BUFFER_WITH_ADDRESS(PostDesc, desc, rel_error_addr, &rel_error_buffer, instance->vkb.rg);
 }
 
 void RayTracer::parse_args(int argc, char* argv[]) {
 	scene_name = "scenes/caustics.json";
-	std::regex fn("(.*).(.json|.xml)");
+	std::regex fn("(.*).(.json|.xml|.gltf|.glb)");
+	// Command line settings are the defaults of every job
+	RenderJob defaults;
+	std::string job_file;
 	for (int i = 0; i < argc; i++) {
 		if (std::regex_match(argv[i], fn)) {
 			scene_name = argv[i];
+		} else if (strcmp(argv[i], "--shader-bundle") == 0 && i + 1 < argc) {
+			ShaderBundle::load(argv[++i]);
+		} else if (strcmp(argv[i], "--spp") == 0 && i + 1 < argc) {
+			defaults.spp = (uint32_t)std::stoul(argv[++i]);
+		} else if (strcmp(argv[i], "--time-budget") == 0 && i + 1 < argc) {
+			defaults.time_budget = std::stof(argv[++i]);
+		} else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+			defaults.output_path = argv[++i];
+		} else if (strcmp(argv[i], "--target-error") == 0 && i + 1 < argc) {
+			defaults.target_error = std::stof(argv[++i]);
+		} else if (strcmp(argv[i], "--resolution") == 0 && i + 1 < argc) {
+			std::cmatch match;
+			if (!std::regex_match(argv[++i], match, std::regex("(\\d+)x(\\d+)"))) {
+				LUMEN_ERROR(fmt::format("Invalid resolution {}, expected <width>x<height>", argv[i]));
+			}
+			offline_width = (uint32_t)std::stoul(match[1].str());
+			offline_height = (uint32_t)std::stoul(match[2].str());
+		} else if (strcmp(argv[i], "--tile-size") == 0 && i + 1 < argc) {
+			tile_size = (uint32_t)std::stoul(argv[++i]);
+		} else if (strcmp(argv[i], "--host-as-builds") == 0) {
+			vkb.host_as_builds = true;
+		} else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+			job_file = argv[++i];
+		}
+	}
+	defaults.scene = scene_name;
+	if (job_file.empty()) {
+		jobs = {defaults};
+		return;
+	}
+	jobs = load_job_file(job_file, defaults);
+	if (jobs.empty()) {
+		LUMEN_ERROR(fmt::format("No jobs in {}", job_file));
+	}
+	// The first job's scene is the one loaded on init
+	scene_name = jobs[0].scene;
+}
+
+std::vector<RayTracer::RenderJob> RayTracer::load_job_file(const std::string& path, const RenderJob& defaults) {
+	using json = nlohmann::json;
+	std::ifstream file(path);
+	if (!file) {
+		LUMEN_ERROR(fmt::format("Could not open job file {}", path));
+	}
+	json j;
+	try {
+		file >> j;
+	} catch (const json::exception& e) {
+		LUMEN_ERROR(fmt::format("Could not parse job file {}: {}", path, e.what()));
+	}
+	auto get_vec3 = [](const json& v) { return glm::vec3{v[0], v[1], v[2]}; };
+	std::vector<RenderJob> jobs;
+	for (const auto& entry : j["jobs"]) {
+		RenderJob job = defaults;
+		job.scene = entry.value("scene", defaults.scene);
+		job.output_path = entry.value("output", "job" + std::to_string(jobs.size()) + ".exr");
+		job.spp = entry.value("spp", defaults.spp);
+		job.time_budget = entry.value("time_budget", defaults.time_budget);
+		job.target_error = entry.value("target_error", defaults.target_error);
+		// Either the integrator type or an object in the same form as in scene files
+		if (entry.contains("integrator")) {
+			const auto& integrator = entry["integrator"];
+			job.integrator = integrator.is_string() ? integrator.get<std::string>() : integrator.value("type", "");
+			if (integrator.is_object()) {
+				auto get_flag = [](const json& v) { return v.is_boolean() ? v.get<bool>() : v == 1; };
+				auto& settings = job.integrator_settings;
+				for (const auto& item : integrator.items()) {
+					const auto& key = item.key();
+					const auto& value = item.value();
+					if (key == "type") {
+						continue;
+					} else if (key == "path_length") {
+						settings.path_length = value.get<int>();
+					} else if (key == "sky_col") {
+						settings.sky_col = get_vec3(value);
+					} else if (key == "base_radius") {
+						settings.base_radius = value.get<float>();
+					} else if (key == "radius_factor") {
+						settings.radius_factor = value.get<float>();
+					} else if (key == "mutations_per_pixel") {
+						settings.mutations_per_pixel = value.get<float>();
+					} else if (key == "num_bootstrap_samples") {
+						settings.num_bootstrap_samples = value.get<int>();
+					} else if (key == "num_mlt_threads") {
+						settings.num_mlt_threads = value.get<int>();
+					} else if (key == "enable_vm") {
+						settings.enable_vm = get_flag(value);
+					} else if (key == "light_first") {
+						settings.light_first = get_flag(value);
+					} else if (key == "alternate") {
+						settings.alternate = get_flag(value);
+					} else {
+						LUMEN_WARN("Job file {}: ignoring unknown integrator setting {}", path, key);
+					}
+				}
+			}
+		}
+		if (entry.contains("camera")) {
+			const auto& camera = entry["camera"];
+			CameraSettings cam_settings;
+			cam_settings.fov = camera.value("fov", 0.0f);
+			cam_settings.pos = get_vec3(camera.at("position"));
+			cam_settings.dir = get_vec3(camera.at("dir"));
+			job.camera = cam_settings;
 		}
+		jobs.push_back(std::move(job));
 	}
+	return jobs;
 }
 
-void RayTracer::save_exr(const float* rgb, int width, int height, const char* outfilename) {
+void RayTracer::start_job(const RenderJob& job) {
+	// Nothing the previous job submitted may still reference what is replaced
+	vkDeviceWaitIdle(vkb.ctx.device);
+	const bool scene_changed = job.scene != scene_name;
+	if (scene_changed) {
+		integrator->destroy();
+		integrator.reset();
+		vkb.destroy_acceleration_structures();
+		scene_name = job.scene;
+		load_scene();
+	}
+	// Integrators read their settings on init
+	const SceneConfig prev_config = scene.config;
+	scene.config = scene_config;
+	if (!job.integrator.empty() && !scene.set_integrator(job.integrator)) {
+		LUMEN_ERROR(fmt::format("Unknown integrator {}", job.integrator));
+	}
+	const auto& settings = job.integrator_settings;
+	auto& config = scene.config;
+	config.path_length = settings.path_length.value_or(config.path_length);
+	config.sky_col = settings.sky_col.value_or(config.sky_col);
+	config.base_radius = settings.base_radius.value_or(config.base_radius);
+	config.radius_factor = settings.radius_factor.value_or(config.radius_factor);
+	config.mutations_per_pixel = settings.mutations_per_pixel.value_or(config.mutations_per_pixel);
+	config.num_bootstrap_samples = settings.num_bootstrap_samples.value_or(config.num_bootstrap_samples);
+	config.num_mlt_threads = settings.num_mlt_threads.value_or(config.num_mlt_threads);
+	config.enable_vm = settings.enable_vm.value_or(config.enable_vm);
+	config.light_first = settings.light_first.value_or(config.light_first);
+	config.alternate = settings.alternate.value_or(config.alternate);
+	if (job.camera) {
+		const float fov = scene.config.cam_settings.fov;
+		scene.config.cam_settings = *job.camera;
+		if (scene.config.cam_settings.fov <= 0) {
+			scene.config.cam_settings.fov = fov;
+		}
+	}
+	// The variance passes are only added while the graph records, a recorded graph
+	// is recorded again when they come or go
+	const bool variance_changed = track_variance != (job.target_error > 0) && !vkb.rg->recording;
+	track_variance = job.target_error > 0;
+	const bool settings_changed =
+		prev_config.path_length != config.path_length || prev_config.sky_col != config.sky_col ||
+		prev_config.base_radius != config.base_radius || prev_config.radius_factor != config.radius_factor ||
+		prev_config.mutations_per_pixel != config.mutations_per_pixel ||
+		prev_config.num_bootstrap_samples != config.num_bootstrap_samples ||
+		prev_config.num_mlt_threads != config.num_mlt_threads || prev_config.enable_vm != config.enable_vm ||
+		prev_config.light_first != config.light_first || prev_config.alternate != config.alternate;
+	if (!scene_changed && integrator_type == scene.config.integrator_type && !settings_changed &&
+		!variance_changed) {
+		// Same scene and integrator, only the camera and the accumulation are reset
+		integrator->create_camera();
+	} else {
+		std::unique_ptr<Integrator> prev = std::move(integrator);
+		create_integrator();
+		if (prev) {
+			// Another integrator for the same scene keeps its geometry and acceleration structures
+			integrator->take_scene_resources(*prev);
+			prev->destroy();
+		}
+		// Pipelines of passes that come back with the same shaders are reused
+		vkb.rg->clear_passes();
+		integrator->init();
+		register_post_buffers();
+	}
+	if (track_variance && !integrator->supports_variance()) {
+		LUMEN_ERROR(fmt::format("target_error needs an integrator that averages independent frames, {} does not",
+								scene.config.integrator_name));
+	}
+	integrator->updated = true;
+	integrator->update();
+}
+
+uint32_t RayTracer::accumulate(const RenderJob& job, float time_budget, float& rel_error) {
+	// Without limits, render a fixed number of frames
+	constexpr uint32_t DEFAULT_OFFLINE_SPP = 1024;
+	// Frames between relative error readbacks, the first one needs enough samples for a stable estimate
+	constexpr uint32_t ERROR_CHECK_INTERVAL = 16;
+	const uint32_t target_spp =
+		job.spp ? job.spp : (time_budget > 0 || job.target_error > 0 ? 0 : DEFAULT_OFFLINE_SPP);
+	const auto begin = std::chrono::steady_clock::now();
+	auto elapsed = [&begin]() {
+		return std::chrono::duration<float>(std::chrono::steady_clock::now() - begin).count();
+	};
+	// Frame whose relative error has not been read back yet
+	std::optional<uint32_t> pending_check;
+	rel_error = -1;
+	uint32_t num_frames = 0;
+	bool last_frame = false;
+	while (!last_frame) {
+		const uint32_t frame_idx = vkb.prepare_frame();
+		// The frame in flight that reduced the error has finished once its slot comes around again
+		if (pending_check && num_frames >= *pending_check + MAX_FRAMES_IN_FLIGHT) {
+			rel_error = *(float*)rel_error_buffer.data;
+			pending_check.reset();
+		}
+		const bool converged = rel_error >= 0 && rel_error <= job.target_error;
+		last_frame = converged || (target_spp && num_frames + 1 >= target_spp) ||
+					 (time_budget > 0 && elapsed() >= time_budget);
+		// The last frame copies the output for the readback
+		write_exr = last_frame;
+		post_pc.frame_num = num_frames;
+		check_error = track_variance && !pending_check && (num_frames + 1) % ERROR_CHECK_INTERVAL == 0;
+		if (check_error) {
+			pending_check = num_frames;
+		}
+		render(frame_idx);
+		vkb.submit_frame(frame_idx, resized);
+		vkb.rg->reset(vkb.ctx.command_buffers[frame_idx]);
+		integrator->update();
+		num_frames++;
+	}
+	vkb.wait_frames_in_flight();
+	write_exr = false;
+	check_error = false;
+	return num_frames;
+}
+
+bool RayTracer::render_job(const RenderJob& job) {
+	const auto begin = std::chrono::steady_clock::now();
+	auto elapsed = [&begin]() {
+		return std::chrono::duration<float>(std::chrono::steady_clock::now() - begin).count();
+	};
+	const uint32_t tiles_x = (image_width + width - 1) / width;
+	const uint32_t tiles_y = (image_height + height - 1) / height;
+	const uint32_t num_tiles = tiles_x * tiles_y;
+	if (num_tiles == 1) {
+		float rel_error;
+		const uint32_t num_frames = accumulate(job, job.time_budget, rel_error);
+		if (rel_error >= 0) {
+			LUMEN_TRACE("Rendered {} frames in {:.2f} s, relative error {:.4f}", num_frames, elapsed(), rel_error);
+		} else {
+			LUMEN_TRACE("Rendered {} frames in {:.2f} s", num_frames, elapsed());
+		}
+		return save_exr((float*)output_img_buffer_cpu.data, width, height, job.output_path.c_str());
+	}
+	// The integrator renders one tile at a time through a narrowed projection, its buffers
+	// are reused for every tile and only the final image lives on the host
+	std::vector<float> image((size_t)image_width * image_height * 4);
+	const float* tile_pixels = (float*)output_img_buffer_cpu.data;
+	for (uint32_t tile_idx = 0; tile_idx < num_tiles; tile_idx++) {
+		const uint32_t x0 = (tile_idx % tiles_x) * width;
+		const uint32_t y0 = (tile_idx / tiles_x) * height;
+		integrator->camera->set_tile({x0, y0}, {width, height}, {image_width, image_height});
+		// Restarts the accumulation like a camera change
+		integrator->updated = true;
+		integrator->update();
+		// What is left of the budget is shared by the remaining tiles
+		float tile_budget = 0;
+		if (job.time_budget > 0) {
+			tile_budget = std::max((job.time_budget - elapsed()) / (num_tiles - tile_idx), 1e-3f);
+		}
+		float rel_error;
+		const uint32_t num_frames = accumulate(job, tile_budget, rel_error);
+		if (rel_error >= 0) {
+			LUMEN_TRACE("Tile {}/{}: {} frames, relative error {:.4f}", tile_idx + 1, num_tiles, num_frames,
+						rel_error);
+		} else {
+			LUMEN_TRACE("Tile {}/{}: {} frames", tile_idx + 1, num_tiles, num_frames);
+		}
+		// Edge tiles extend past the image, their outer pixels are dropped
+		const uint32_t copy_width = std::min(width, image_width - x0);
+		const uint32_t copy_height = std::min(height, image_height - y0);
+		for (uint32_t y = 0; y < copy_height; y++) {
+			memcpy(&image[((size_t)(y0 + y) * image_width + x0) * 4], &tile_pixels[(size_t)y * width * 4],
+				   copy_width * 4 * sizeof(float));
+		}
+	}
+	LUMEN_TRACE("Rendered {} tiles in {:.2f} s", num_tiles, elapsed());
+	return save_exr(image.data(), image_width, image_height, job.output_path.c_str());
+}
+
+bool RayTracer::render_offline() {
+	bool saved = true;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		if (jobs.size() > 1) {
+			LUMEN_TRACE("Job {}/{}: {} -> {}", i + 1, jobs.size(), jobs[i].scene, jobs[i].output_path);
+		}
+		start_job(jobs[i]);
+		saved &= render_job(jobs[i]);
+	}
+	return saved;
+}
+
+bool RayTracer::save_exr(const float* rgb, int width, int height, const char* outfilename) {
 	EXRHeader header;
 	InitEXRHeader(&header);
 	EXRImage image;
@@ -427,32 +819,39 @@ void RayTracer::save_exr(const float* rgb, int width, int height, const char* ou
 	if (ret != TINYEXR_SUCCESS) {
 		fprintf(stderr, "Save EXR err: %s\n", err);
 		FreeEXRErrorMessage(err);  // free's buffer for an error message
+	} else {
+		printf("Saved exr file. [ %s ] \n", outfilename);
 	}
-	printf("Saved exr file. [ %s ] \n", outfilename);
 
 	free(header.channels);
 	free(header.pixel_types);
 	free(header.requested_pixel_types);
+	return ret == TINYEXR_SUCCESS;
 }
 
 void RayTracer::cleanup() {
 	const auto device = vkb.ctx.device;
 	vkDeviceWaitIdle(device);
 	if (initialized) {
-		ImGui_ImplVulkan_Shutdown();
-		ImGui_ImplGlfw_Shutdown();
-		ImGui::DestroyContext();
-		vkDestroyDescriptorPool(device, imgui_pool, nullptr);
+		if (window) {
+			ImGui_ImplVulkan_Shutdown();
+			ImGui_ImplGlfw_Shutdown();
+			ImGui::DestroyContext();
+			vkDestroyDescriptorPool(device, imgui_pool, nullptr);
+		}
 
 		std::vector<Buffer*> buffer_list = {&output_img_buffer, &output_img_buffer_cpu, &residual_buffer,
-											&counter_buffer,	&rmse_val_buffer,		&post_desc_buffer};
+											&counter_buffer,	&rmse_val_buffer,		&post_desc_buffer,
+											&variance_buffer,	&rel_error_buffer};
 		if (load_exr) {
 			buffer_list.push_back(&gt_img_buffer);
 		}
 		for (auto b : buffer_list) {
 			b->destroy();
 		}
-		integrator->destroy();
+		if (integrator) {
+			integrator->destroy();
+		}
 		vkb.cleanup();
 	}
 }
@@ -18,6 +18,8 @@ class RayTracer : public LumenInstance {
 	void init(Window*) override;
 	void update() override;
 	void cleanup() override;
+	// Headless rendering of every job, returns false if an image could not be written
+	bool render_offline();
 	static RayTracer* instance;
 	inline static RayTracer* get() { return instance; }
 	bool resized = false;
@@ -26,13 +28,51 @@ class RayTracer : public LumenInstance {
 	struct Settings {
 		bool enable_tonemapping = false;
 	};
+	// One image of a headless run. Consecutive jobs of the same scene keep its geometry,
+	// acceleration structures and pipelines
+	struct RenderJob {
+		std::string scene;
+		// Integrator name as in scene files, empty for the scene's own
+		std::string integrator;
+		// Integrator settings as in scene files, unset ones keep the scene's
+		struct IntegratorSettings {
+			std::optional<int> path_length;
+			std::optional<glm::vec3> sky_col;
+			std::optional<float> base_radius;
+			std::optional<float> radius_factor;
+			std::optional<float> mutations_per_pixel;
+			std::optional<int> num_bootstrap_samples;
+			std::optional<int> num_mlt_threads;
+			std::optional<bool> enable_vm;
+			std::optional<bool> light_first;
+			std::optional<bool> alternate;
+		} integrator_settings;
+		// Replaces the scene's camera, a zero fov keeps the scene's
+		std::optional<CameraSettings> camera;
+		// One sample per pixel and frame for most integrators, 0 renders until the time budget runs out
+		uint32_t spp = 0;
+		// In seconds, 0 means no limit
+		float time_budget = 0;
+		// Estimated relative error the render stops at, 0 to disable
+		float target_error = 0;
+		std::string output_path = "out.exr";
+	};
 
+	void load_scene();
+	void create_integrator();
+	void start_job(const RenderJob& job);
+	bool render_job(const RenderJob& job);
+	// Renders frames until one of the job's limits is reached, then reads the output back
+	// into output_img_buffer_cpu. Returns the number of frames
+	uint32_t accumulate(const RenderJob& job, float time_budget, float& rel_error);
+	static std::vector<RenderJob> load_job_file(const std::string& path, const RenderJob& defaults);
+	void register_post_buffers();
 	void render(uint32_t idx);
 	float draw_frame();
 	void init_imgui();
 	void init_resources();
 	void parse_args(int argc, char* argv[]);
-	void save_exr(const float* rgb, int width, int height, const char* outfilename);
+	bool save_exr(const float* rgb, int width, int height, const char* outfilename);
 	bool initialized = false;
 	bool rt_initialized = false;
 	float cpu_avg_time = 0;
@@ -41,6 +81,12 @@ class RayTracer : public LumenInstance {
 	VkDescriptorPool imgui_pool = 0;
 	PushConstantPost pc_post_settings;
 	Settings settings;
+	std::vector<RenderJob> jobs;
+	// Headless image size, 0 for the default
+	uint32_t offline_width = 0;
+	uint32_t offline_height = 0;
+	// Headless images larger than a tile are rendered tile by tile, 0 to disable
+	uint32_t tile_size = 0;
 	Buffer gt_img_buffer;
 	Buffer output_img_buffer;
 	Buffer output_img_buffer_cpu;
@@ -48,12 +94,21 @@ class RayTracer : public LumenInstance {
 	Buffer residual_buffer;
 	Buffer counter_buffer;
 	Buffer rmse_val_buffer;
+	// Running per pixel variance of offline renders, reduced to a relative error estimate
+	Buffer variance_buffer;
+	Buffer rel_error_buffer;
 	PostPC post_pc;
 	std::string scene_name;
 	LumenScene scene;
+	// As loaded, jobs override their copy
+	SceneConfig scene_config;
+	IntegratorType integrator_type = IntegratorType::Path;
 
 	clock_t start;
 	bool write_exr = false;
+	// Set for the whole job, the variance passes are part of the recorded graph
+	bool track_variance = false;
+	bool check_error = false;
 	bool has_gt = false;
 	bool show_cam_stats = false;
 
@@ -65,7 +65,6 @@ void ReSTIR::init() {
 }
 
 void ReSTIR::render() {
-	CommandBuffer cmd(&instance->vkb.ctx, /*start*/ true, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 	pc_ray.light_pos = scene_ubo.light_pos;
 	pc_ray.light_type = 0;
 	pc_ray.light_intensity = 10;
@@ -143,7 +142,6 @@ void ReSTIR::render() {
 	if (!do_spatiotemporal) {
 		do_spatiotemporal = true;
 	}
-	instance->vkb.rg->run_and_submit(cmd);
 }
 
 bool ReSTIR::update() {
@@ -67,7 +67,6 @@ void ReSTIRGI::init() {
 }
 
 void ReSTIRGI::render() {
-	CommandBuffer cmd(&instance->vkb.ctx, /*start*/ true, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 	pc_ray.light_pos = scene_ubo.light_pos;
 	pc_ray.light_type = 0;
 	pc_ray.light_intensity = 10;
@@ -153,7 +152,6 @@ void ReSTIRGI::render() {
 		do_spatiotemporal = true;
 	}
 	pc_ray.total_frame_num++;
-	instance->vkb.rg->run_and_submit(cmd);
 }
 
 bool ReSTIRGI::update() {
@@ -115,7 +115,6 @@ void VCM::init() {
 }
 
 void VCM::render() {
-	CommandBuffer cmd(&instance->vkb.ctx, /*start*/ true, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 	const float ppm_base_radius = 0.25f;
 	pc_ray.light_pos = scene_ubo.light_pos;
 	pc_ray.light_type = 0;
@@ -263,7 +262,6 @@ void VCM::render() {
 	if (!do_spatiotemporal) {
 		do_spatiotemporal = true;
 	}
-	instance->vkb.rg->run_and_submit(cmd);
 }
 
 bool VCM::update() {
@@ -1,5 +1,6 @@
 #include "LumenPCH.h"
 #include "Framework/Window.h"
+#include "Framework/ShaderBundle.h"
 //#include "RTScene.h"
 #include "RayTracer/RayTracer.h"
 
@@ -16,6 +17,50 @@ int main(int argc, char* argv[]) {
 	int height = 900;
 	Logger::init();
 	ThreadPool::init();
+	// Offline mode: compile every shader into a bundle without creating a window or device.
+	// Scenes given after the bundle path add the BSDF permutations they need
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--build-shader-bundle") == 0) {
+			const std::string bundle_path = i + 1 < argc ? argv[i + 1] : ShaderBundle::DEFAULT_PATH;
+			std::vector<ShaderDefines> variants;
+			for (int j = i + 2; j < argc; j++) {
+				LumenScene scene;
+				scene.load_scene(argv[j]);
+				auto defines = scene.get_bsdf_defines();
+				if (std::find(variants.begin(), variants.end(), defines) == variants.end()) {
+					variants.push_back(std::move(defines));
+				}
+			}
+			if (variants.empty()) {
+				// Every BSDF enabled, which works for any scene
+				auto defines = LumenScene().get_bsdf_defines();
+				for (auto& [name, value] : defines) {
+					value = "1";
+				}
+				variants.push_back(std::move(defines));
+			}
+			const bool built = ShaderBundle::build("src/shaders", bundle_path, variants);
+			ThreadPool::destroy();
+			return built ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	// Headless mode: render the scene, or every job of a job file, and write the results without a window
+	const bool headless = std::any_of(argv + 1, argv + argc, [](const char* arg) {
+		return strcmp(arg, "--headless") == 0 || strcmp(arg, "--jobs") == 0;
+	});
+	if (headless) {
+		bool rendered = false;
+		try {
+			RayTracer app(width, height, enable_debug, argc, argv);
+			app.init(nullptr);
+			rendered = app.render_offline();
+			app.cleanup();
+		} catch (const std::exception& e) {
+			LUMEN_CRITICAL("Headless render failed: {}", e.what());
+		}
+		ThreadPool::destroy();
+		return rendered ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 	Window window(width, height, fullscreen);
 	{
 		RayTracer app(width, height, enable_debug, argc, argv);
@@ -1,3 +1,21 @@
+// BSDFs compiled into the shader. The render graph sets these from the
+// materials of the loaded scene, every BSDF is enabled otherwise
+#ifndef ENABLE_DIFFUSE
+#define ENABLE_DIFFUSE 1
+#endif
+#ifndef ENABLE_MIRROR
+#define ENABLE_MIRROR 1
+#endif
+#ifndef ENABLE_GLASS
+#define ENABLE_GLASS 1
+#endif
+#ifndef ENABLE_GLOSSY
+#define ENABLE_GLOSSY 1
+#endif
+#ifndef ENABLE_DISNEY
+#define ENABLE_DISNEY 1
+#endif
+
 Material load_material(const uint material_idx, const vec2 uv) {
     Material m = materials.m[material_idx];
     if (m.texture_id > -1) {
@@ -118,17 +136,22 @@ vec3 sample_bsdf(const vec3 n_s, const vec3 wo, const Material mat,
                  out float pdf_w, out float cos_theta, const vec2 rands) {
     vec3 f;
     switch (mat.bsdf_type) {
+#if ENABLE_DIFFUSE
     case BSDF_DIFFUSE: {
         dir = sample_cos_hemisphere(rands, n_s);
         f = diffuse_f(mat);
         pdf_w = diffuse_pdf(n_s, dir, cos_theta);
     } break;
+#endif
+#if ENABLE_MIRROR
     case BSDF_MIRROR: {
         dir = reflect(-wo, n_s);
         cos_theta = dot(n_s, dir);
         f = vec3(1.) / abs(cos_theta);
         pdf_w = 1.;
     } break;
+#endif
+#if ENABLE_GLOSSY
     case BSDF_GLOSSY: {
         if (rands.x < .5) {
             const vec2 rands_new = vec2(2 * rands.x, rands.y);
@@ -153,10 +176,11 @@ vec3 sample_bsdf(const vec3 n_s, const vec3 wo, const Material mat,
         f = glossy_f(mat, wo, dir, n_s, hl, nl, nv, beckmann_term);
         pdf_w = glossy_pdf(cos_theta, hl, nh, beckmann_term);
     } break;
+#endif
 
+#if ENABLE_DISNEY
     case BSDF_DISNEY: {
 
-#if ENABLE_DISNEY
         const float diffuse_ratio = 0.5 * (1 - mat.metallic);
         if (rands.x < diffuse_ratio) {
             // Sample diffuse
@@ -194,8 +218,9 @@ vec3 sample_bsdf(const vec3 n_s, const vec3 wo, const Material mat,
         f = disney_f(mat, wo, dir, n_s);
         pdf_w = disney_pdf(n_s, mat, wo, dir);
         cos_theta = dot(n_s, dir);
-#endif
     } break;
+#endif
+#if ENABLE_GLASS
     case BSDF_GLASS: {
         const float ior = side ? 1. / mat.ior : mat.ior;
 
@@ -216,6 +241,7 @@ vec3 sample_bsdf(const vec3 n_s, const vec3 wo, const Material mat,
         pdf_w = 1.;
 
     } break;
+#endif
     default: // Unknown
         break;
     }
@@ -234,18 +260,25 @@ vec3 eval_bsdf(const vec3 n_s, const vec3 wo, const Material mat,
                out float pdf_w, float cos_theta) {
     vec3 f;
     switch (mat.bsdf_type) {
+#if ENABLE_DIFFUSE
     case BSDF_DIFFUSE: {
         f = diffuse_f(mat);
         pdf_w = diffuse_pdf(n_s, dir);
     } break;
+#endif
+#if ENABLE_MIRROR
     case BSDF_MIRROR: {
         f = vec3(0);
         pdf_w = 0.;
     } break;
+#endif
+#if ENABLE_GLASS
     case BSDF_GLASS: {
         f = vec3(0);
         pdf_w = 0.;
     } break;
+#endif
+#if ENABLE_GLOSSY
     case BSDF_GLOSSY: {
         if (!same_hemisphere(dir, wo, n_s)) {
             f = vec3(0);
@@ -262,8 +295,9 @@ vec3 eval_bsdf(const vec3 n_s, const vec3 wo, const Material mat,
         }
 
     } break;
-    case BSDF_DISNEY: {
+#endif
 #if ENABLE_DISNEY
+    case BSDF_DISNEY: {
         if (!same_hemisphere(dir, wo, n_s)) {
             f = vec3(0);
             pdf_w = 0.;
@@ -271,8 +305,8 @@ vec3 eval_bsdf(const vec3 n_s, const vec3 wo, const Material mat,
             f = disney_f(mat, wo, dir, n_s);
             pdf_w = disney_pdf(n_s, mat, wo, dir);
         }
-#endif
     } break;
+#endif
     default: // Unknown
         break;
     }
@@ -284,21 +318,28 @@ vec3 eval_bsdf(const vec3 n_s, const vec3 wo, const Material mat,
                out float pdf_w, out float pdf_rev_w, in float cos_theta) {
     vec3 f;
     switch (mat.bsdf_type) {
+#if ENABLE_DIFFUSE
     case BSDF_DIFFUSE: {
         f = diffuse_f(mat);
         pdf_w = diffuse_pdf(n_s, dir);
         pdf_rev_w = diffuse_pdf(n_s, wo);
     } break;
+#endif
+#if ENABLE_MIRROR
     case BSDF_MIRROR: {
         f = vec3(0);
         pdf_w = 0.;
         pdf_rev_w = 0.;
     } break;
+#endif
+#if ENABLE_GLASS
     case BSDF_GLASS: {
         f = vec3(0);
         pdf_w = 0.;
         pdf_rev_w = 0.;
     } break;
+#endif
+#if ENABLE_GLOSSY
     case BSDF_GLOSSY: {
         if (!same_hemisphere(dir, wo, n_s)) {
             f = vec3(0);
@@ -316,13 +357,14 @@ vec3 eval_bsdf(const vec3 n_s, const vec3 wo, const Material mat,
             pdf_rev_w = glossy_pdf(cos_theta_wo, hl, nh, beckmann_term);
         }
     } break;
-    case BSDF_DISNEY: {
+#endif
 #if ENABLE_DISNEY
+    case BSDF_DISNEY: {
         f = disney_f(mat, wo, dir, n_s);
         pdf_w = disney_pdf(n_s, mat, wo, dir);
         pdf_rev_w = disney_pdf(n_s, mat, dir, wo);
-#endif
     } break;
+#endif
     default: // Unknown
         break;
     }
@@ -332,13 +374,18 @@ vec3 eval_bsdf(const vec3 n_s, const vec3 wo, const Material mat,
 vec3 eval_bsdf(const Material mat, const vec3 wo, const vec3 wi,
                const vec3 n_s) {
     switch (mat.bsdf_type) {
+#if ENABLE_DIFFUSE
     case BSDF_DIFFUSE: {
         return diffuse_f(mat);
     } break;
+#endif
+#if ENABLE_MIRROR || ENABLE_GLASS
     case BSDF_MIRROR:
     case BSDF_GLASS: {
         return vec3(0);
     } break;
+#endif
+#if ENABLE_GLOSSY
     case BSDF_GLOSSY: {
         if (!same_hemisphere(wi, wo, n_s)) {
             return vec3(0);
@@ -351,11 +398,12 @@ vec3 eval_bsdf(const Material mat, const vec3 wo, const vec3 wi,
         float beckmann_term = beckmann_d(mat.roughness, nh);
         return glossy_f(mat, wo, wi, n_s, hl, nl, nv, beckmann_term);
     } break;
-    case BSDF_DISNEY: {
+#endif
 #if ENABLE_DISNEY
+    case BSDF_DISNEY: {
         return disney_f(mat, wo, wi, n_s);
-#endif
     } break;
+#endif
     default: {
         break;
     }
@@ -366,9 +414,12 @@ vec3 eval_bsdf(const Material mat, const vec3 wo, const vec3 wi,
 float bsdf_pdf(const Material mat, const vec3 n_s, const vec3 wo,
                const vec3 wi) {
     switch (mat.bsdf_type) {
+#if ENABLE_DIFFUSE
     case BSDF_DIFFUSE: {
         return diffuse_pdf(n_s, wi);
     } break;
+#endif
+#if ENABLE_GLOSSY
     case BSDF_GLOSSY: {
         if (!same_hemisphere(wo, wi, n_s)) {
             return 0;
@@ -380,11 +431,12 @@ float bsdf_pdf(const Material mat, const vec3 n_s, const vec3 wo,
         float cos_theta = dot(n_s, wi);
         return glossy_pdf(cos_theta, hl, nh, beckmann_term);
     } break;
-    case BSDF_DISNEY: {
+#endif
 #if ENABLE_DISNEY
+    case BSDF_DISNEY: {
         return disney_pdf(n_s, mat, wo, wi);
-#endif
     } break;
+#endif
     }
     return 0;
 }
\ No newline at end of file
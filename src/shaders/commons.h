@@ -47,10 +47,6 @@ using uint = unsigned int;
 #define ALIGN16
 #endif
 
-#define ENABLE_DISNEY 0
-#define DIFFUSE_ONLY 0
-#define DIFFUSE_AND_GLOSSY_ONLY 1
-
 struct PushConstantRay {
     vec4 clear_color;
     vec3 light_pos;
@@ -546,10 +542,14 @@ struct PostDesc {
     uint64_t residual_addr;
     uint64_t counter_addr;
     uint64_t rmse_val_addr;
+    uint64_t variance_addr;
+    uint64_t rel_error_addr;
 };
 
 struct PostPC {
     uint size;
+    // Frames accumulated before the current one, for the variance estimate
+    uint frame_num;
 };
 
 // Structure used for retrieving the primitive information in the closest hit